@@ -0,0 +1,59 @@
+﻿// src/camera.cpp
+#include "camera.hpp"
+#include "shaderprogram.h"
+#include "render_state.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+
+Camera::Camera()
+    : perspective(0.0f), ubo(0), dirty(true)
+{
+    block.P = glm::mat4(1.0f);
+    block.V = glm::mat4(1.0f);
+    block.PV = glm::mat4(1.0f);
+    block.lp = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+    glGenBuffers(1, &ubo);
+    RenderState::bindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), nullptr, GL_DYNAMIC_DRAW);
+    RenderState::bindBuffer(GL_UNIFORM_BUFFER, 0);
+    // Punkt wiązania jest stanem globalnym – wystarczy podpiąć raz
+    RenderState::bindBufferBase(GL_UNIFORM_BUFFER, ShaderProgram::CAMERA_BINDING, ubo);
+}
+
+Camera::~Camera()
+{
+    if (ubo) RenderState::deleteBuffer(ubo);
+}
+
+void Camera::setPerspective(float fovyDeg, float aspect, float zNear, float zFar)
+{
+    glm::vec4 params(fovyDeg, aspect, zNear, zFar);
+    if (params == perspective) return;
+    perspective = params;
+    block.P = glm::perspective(glm::radians(fovyDeg), aspect, zNear, zFar);
+    dirty = true;
+}
+
+void Camera::lookAt(const glm::vec3& eye, const glm::vec3& center, const glm::vec3& up)
+{
+    glm::mat4 V = glm::lookAt(eye, center, up);
+    if (V == block.V) return;
+    block.V = V;
+    dirty = true;
+}
+
+void Camera::setLightPosition(const glm::vec4& position)
+{
+    if (position == block.lp) return;
+    block.lp = position;
+    dirty = true;
+}
+
+void Camera::update()
+{
+    if (!dirty) return;
+    block.PV = block.P * block.V;
+    RenderState::bindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &block);
+    dirty = false;
+}
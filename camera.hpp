@@ -0,0 +1,53 @@
+﻿// include/camera.hpp
+#ifndef CAMERA_HPP
+#define CAMERA_HPP
+
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+
+/**
+ * Dane kamery i światła wspólne dla wszystkich shaderów, trzymane w jednym
+ * buforze uniformów (UBO) podpiętym pod ShaderProgram::CAMERA_BINDING.
+ * Odpowiada blokowi w shaderze:
+ *
+ *   layout(std140) uniform Camera { mat4 P; mat4 V; mat4 PV; vec4 lp; };
+ *
+ * Settery tylko zapamiętują wartości; update() wysyła blok do GPU, i to
+ * wyłącznie wtedy, gdy coś się zmieniło od poprzedniego wysłania.
+ */
+class Camera {
+public:
+    Camera();
+    ~Camera();
+
+    Camera(const Camera&) = delete;
+    Camera& operator=(const Camera&) = delete;
+
+    /// Projekcja perspektywiczna (kąt w stopniach); ta sama co poprzednio nic nie zmienia.
+    void setPerspective(float fovyDeg, float aspect, float zNear, float zFar);
+
+    /// Macierz widoku jak glm::lookAt.
+    void lookAt(const glm::vec3& eye, const glm::vec3& center, const glm::vec3& up);
+
+    /// Pozycja źródła światła w przestrzeni świata.
+    void setLightPosition(const glm::vec4& position);
+
+    /// Wysyła blok do UBO, jeśli od ostatniego razu coś się zmieniło.
+    void update();
+
+private:
+    // Układ std140: same mat4/vec4, więc bez dodatkowego wyrównania
+    struct Block {
+        glm::mat4 P;
+        glm::mat4 V;
+        glm::mat4 PV;
+        glm::vec4 lp;
+    };
+
+    Block block;
+    glm::vec4 perspective; // (fovy, aspect, near, far) ostatniej projekcji
+    GLuint ubo;
+    bool dirty;
+};
+
+#endif // CAMERA_HPP
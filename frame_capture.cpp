@@ -0,0 +1,202 @@
+﻿// src/frame_capture.cpp
+#include "frame_capture.hpp"
+#include "render_state.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "lodepng.h"
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+FrameCapture::FrameCapture(const std::string& directory, unsigned threadCount, size_t maxQueued, Policy policy)
+    : directory(directory), maxQueued(maxQueued ? maxQueued : 1), policy(policy)
+{
+    // Jeden rdzeń zostaje dla pętli renderowania
+    if (threadCount == 0) {
+        unsigned cores = std::thread::hardware_concurrency();
+        threadCount = cores > 1 ? cores - 1 : 1;
+    }
+
+    workers.reserve(threadCount);
+    for (unsigned i = 0; i < threadCount; ++i) {
+        workers.emplace_back(&FrameCapture::workerLoop, this);
+    }
+}
+
+FrameCapture::~FrameCapture()
+{
+    // Bez finish() ostatnia klatka z PBO przepada, ale kolejka i tak jest zapisywana do końca
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (std::thread& t : workers) {
+        if (t.joinable()) t.join();
+    }
+}
+
+void FrameCapture::captureFrame(int width, int height)
+{
+    if (finished || width <= 0 || height <= 0) return; // np. zminimalizowane okno
+    auto start = std::chrono::steady_clock::now();
+
+    // 1) Odczyt bieżącej klatki do PBO – wraca od razu, transfer idzie w tle
+    Readback& rb = readbacks[current];
+    if (!rb.pbo) glGenBuffers(1, &rb.pbo);
+    RenderState::bindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+    if (rb.width != width || rb.height != height) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(width) * height * 4, nullptr, GL_STREAM_READ);
+        rb.width = width;
+        rb.height = height;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    RenderState::bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    rb.index = nextIndex++;
+    rb.pending = true;
+
+    // 2) Odbiór poprzedniej klatki z drugiego PBO – jej transfer zdążył się skończyć
+    current ^= 1u;
+    if (readbacks[current].pending) collect(readbacks[current]);
+
+    double ms = millisecondsSince(start);
+    overheadTotal += ms;
+    overheadMax = std::max(overheadMax, ms);
+}
+
+void FrameCapture::collect(Readback& rb)
+{
+    rb.pending = false;
+
+    Frame frame;
+    frame.index = rb.index;
+    frame.width = rb.width;
+    frame.height = rb.height;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (queue.size() >= maxQueued) {
+            if (policy == Policy::Drop) {
+                ++dropped; // kodowanie nie nadąża – klatka nie jest nawet kopiowana
+                return;
+            }
+            spaceFree.wait(lock, [this] { return queue.size() < maxQueued; });
+        }
+        if (!spareBuffers.empty()) {
+            frame.pixels = std::move(spareBuffers.back());
+            spareBuffers.pop_back();
+        }
+    }
+
+    size_t size = static_cast<size_t>(rb.width) * rb.height * 4;
+    RenderState::bindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+    const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>(size), GL_MAP_READ_BIT);
+    if (data) {
+        frame.pixels.resize(size);
+        std::memcpy(frame.pixels.data(), data, size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    RenderState::bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if (!data) {
+        std::cerr << "[Capture] Nie udało się zmapować PBO klatki " << frame.index << "\n";
+        std::lock_guard<std::mutex> lock(mutex);
+        ++failed;
+        return;
+    }
+    submit(std::move(frame));
+}
+
+void FrameCapture::submit(Frame&& frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(frame));
+        ++captured;
+    }
+    wakeUp.notify_one();
+}
+
+void FrameCapture::finish()
+{
+    if (finished) return;
+    finished = true;
+
+    // Zostaje co najwyżej ostatnia klatka, zlecona w ostatnim captureFrame
+    for (Readback& rb : readbacks) {
+        if (rb.pending) collect(rb);
+        if (rb.pbo) RenderState::deleteBuffer(rb.pbo);
+        rb.pbo = 0;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (std::thread& t : workers) t.join();
+    workers.clear();
+
+    unsigned frames = nextIndex ? nextIndex : 1;
+    std::cout << "[Capture] klatki: " << nextIndex << " (zapisane " << written << ", odrzucone " << dropped
+        << ", błędy " << failed << ") do " << directory << "\n"
+        << "[Capture] narzut na klatkę: śr. " << overheadTotal / frames << " ms, maks. " << overheadMax
+        << " ms; kodowanie PNG: śr. " << (captured ? encodeTotal / captured : 0.0) << " ms\n";
+}
+
+void FrameCapture::workerLoop()
+{
+    for (;;) {
+        Frame frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeUp.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) break; // stopping i nic więcej do zapisania
+            frame = std::move(queue.front());
+            queue.pop_front();
+        }
+        spaceFree.notify_one();
+
+        encodeFrame(frame);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        spareBuffers.push_back(std::move(frame.pixels));
+    }
+}
+
+void FrameCapture::encodeFrame(Frame& frame)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // OpenGL zwraca wiersze od dołu, PNG zapisuje je od góry
+    size_t rowBytes = static_cast<size_t>(frame.width) * 4;
+    for (int y = 0; y < frame.height / 2; ++y) {
+        std::swap_ranges(frame.pixels.begin() + y * rowBytes, frame.pixels.begin() + (y + 1) * rowBytes,
+            frame.pixels.begin() + (frame.height - 1 - y) * rowBytes);
+    }
+
+    // Poziom 1: najszybszy, a na klatkach i tak mniejszy niż domyślne ustawienia
+    lodepng::State state;
+    lodepng_compress_settings_level(&state.encoder.zlibsettings, 1);
+    std::vector<unsigned char> png;
+    unsigned error = lodepng::encode(png, frame.pixels, static_cast<unsigned>(frame.width),
+        static_cast<unsigned>(frame.height), state);
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "frame_%05u.png", frame.index);
+    std::string path = directory + "/" + name;
+    if (!error) error = lodepng::save_file(png, path);
+    if (error) std::cerr << "[Capture] " << path << ": " << lodepng_error_text(error) << "\n";
+
+    double ms = millisecondsSince(start);
+    std::lock_guard<std::mutex> lock(mutex);
+    encodeTotal += ms;
+    if (error) ++failed;
+    else ++written;
+}
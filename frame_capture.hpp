@@ -0,0 +1,94 @@
+﻿// include/frame_capture.hpp
+#ifndef FRAME_CAPTURE_HPP
+#define FRAME_CAPTURE_HPP
+
+#include <GL/glew.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Nagrywanie kolejnych klatek do plików PNG (katalog/frame_00000.png, ...).
+ *
+ * glReadPixels trafia do jednego z dwóch buforów PBO, więc nie czeka na GPU –
+ * piksele klatki N są mapowane dopiero przy klatce N+1, gdy transfer już się
+ * zakończył. Skopiowane piksele idą do kolejki puli wątków, które kodują PNG.
+ * Kolejka ma ograniczoną długość: przy jej zapełnieniu klatka jest odrzucana
+ * (Drop) albo pętla renderowania czeka na wolne miejsce (Block).
+ */
+class FrameCapture {
+public:
+    enum class Policy { Drop, Block };
+
+    /**
+     * @param directory   Istniejący katalog na pliki PNG
+     * @param threadCount Liczba wątków kodujących (0 = liczba rdzeni - 1, min. 1)
+     * @param maxQueued   Maksymalna liczba klatek czekających na zakodowanie
+     * @param policy      Co zrobić z klatką, gdy kolejka jest pełna
+     */
+    FrameCapture(const std::string& directory, unsigned threadCount = 0,
+        size_t maxQueued = 8, Policy policy = Policy::Drop);
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    /// Zleca odczyt bieżącego bufora ramki (po drawScene, przed glfwSwapBuffers).
+    void captureFrame(int width, int height);
+
+    /// Odbiera ostatnią klatkę z PBO, zwalnia bufory GL i czeka na zapis wszystkich plików.
+    /// Wymaga aktywnego kontekstu GL; wypisuje podsumowanie narzutu.
+    void finish();
+
+private:
+    struct Frame {
+        unsigned index = 0;
+        int width = 0;
+        int height = 0;
+        std::vector<unsigned char> pixels; // RGBA, wiersze od dołu (jak w OpenGL)
+    };
+
+    struct Readback {
+        GLuint pbo = 0;
+        int width = 0;
+        int height = 0;
+        unsigned index = 0;
+        bool pending = false; // glReadPixels zlecony, dane jeszcze nieodebrane
+    };
+
+    void collect(Readback& rb);
+    void submit(Frame&& frame);
+    void workerLoop();
+    void encodeFrame(Frame& frame);
+
+    std::string directory;
+    size_t maxQueued;
+    Policy policy;
+
+    Readback readbacks[2];
+    unsigned current = 0;   // PBO, do którego trafi następny glReadPixels
+    unsigned nextIndex = 0; // numer następnej klatki (także odrzuconych)
+    bool finished = false;
+
+    std::vector<std::thread> workers;
+    std::deque<Frame> queue;
+    std::vector<std::vector<unsigned char>> spareBuffers; // bufory zakodowanych klatek do ponownego użycia
+    std::mutex mutex;
+    std::condition_variable wakeUp;    // nowa klatka w kolejce albo koniec
+    std::condition_variable spaceFree; // zwolniło się miejsce w kolejce (Policy::Block)
+    bool stopping = false;
+
+    // Statystyki (czasy w ms); narzut mierzony w wątku renderowania
+    unsigned captured = 0;
+    unsigned dropped = 0;
+    unsigned written = 0;
+    unsigned failed = 0;
+    double overheadTotal = 0.0;
+    double overheadMax = 0.0;
+    double encodeTotal = 0.0;
+};
+
+#endif // FRAME_CAPTURE_HPP
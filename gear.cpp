@@ -1,12 +1,14 @@
 ﻿// src/gear.cpp
 
 #include "gear.hpp"
+#include "instancing.hpp"
+#include "render_state.hpp"
 #include <glm/gtc/constants.hpp>  // glm::pi<float>()
 #include <iostream>
 
 Gear::Gear(float outerRadius, float innerRadius, int teethCount_, float rpm_)
     : outerR(outerRadius), innerR(innerRadius), teethCount(teethCount_), rpm(rpm_),
-    vao(0), vbo(0), ebo(0), indexCount(0)
+    vao(0), vbo(0), ebo(0), indexCount(0), instanceVbo(0), instanceCount(0)
 {
     buildGeometry();
 
@@ -15,7 +17,7 @@ Gear::Gear(float outerRadius, float innerRadius, int teethCount_, float rpm_)
     glGenBuffers(1, &vbo);
     glGenBuffers(1, &ebo);
 
-    glBindVertexArray(vao);
+    RenderState::bindVertexArray(vao);
 
     // Przygotowujemy bufor interleaved: [pos (4 floats)] [normal (4 floats)] [color (4 floats)]
     std::vector<float> interleaved;
@@ -40,7 +42,7 @@ Gear::Gear(float outerRadius, float innerRadius, int teethCount_, float rpm_)
     }
 
     // VBO – interleaved
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    RenderState::bindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferData(GL_ARRAY_BUFFER,
         interleaved.size() * sizeof(float),
         interleaved.data(),
@@ -58,7 +60,7 @@ Gear::Gear(float outerRadius, float innerRadius, int teethCount_, float rpm_)
     glEnableVertexAttribArray(1);
 
     // EBO – indeksy
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    RenderState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER,
         indices.size() * sizeof(GLuint),
         indices.data(),
@@ -66,7 +68,7 @@ Gear::Gear(float outerRadius, float innerRadius, int teethCount_, float rpm_)
 
     indexCount = indices.size();
 
-    glBindVertexArray(0);
+    RenderState::bindVertexArray(0);
 
     // Debug
     std::cout << "[Gear] VAO=" << vao << " VBO=" << vbo
@@ -75,9 +77,10 @@ Gear::Gear(float outerRadius, float innerRadius, int teethCount_, float rpm_)
 
 Gear::~Gear()
 {
-    if (ebo) glDeleteBuffers(1, &ebo);
-    if (vbo) glDeleteBuffers(1, &vbo);
-    if (vao) glDeleteVertexArrays(1, &vao);
+    if (instanceVbo) RenderState::deleteBuffer(instanceVbo);
+    if (ebo) RenderState::deleteBuffer(ebo);
+    if (vbo) RenderState::deleteBuffer(vbo);
+    if (vao) RenderState::deleteVertexArray(vao);
 }
 
 void Gear::buildGeometry()
@@ -167,9 +170,26 @@ void Gear::buildGeometry()
 
 void Gear::draw()
 {
-    glBindVertexArray(vao);
+    RenderState::bindVertexArray(vao);
     glDrawElements(GL_TRIANGLES,
         static_cast<GLsizei>(indexCount),
         GL_UNSIGNED_INT, nullptr);
-    glBindVertexArray(0);
+    RenderState::countDraw();
+}
+
+void Gear::setInstances(const std::vector<glm::mat4>& models)
+{
+    instanceVbo = uploadInstanceMatrices(vao, instanceVbo, models);
+    instanceCount = models.size();
+}
+
+void Gear::drawInstanced()
+{
+    if (instanceCount == 0) return;
+    RenderState::bindVertexArray(vao);
+    glDrawElementsInstanced(GL_TRIANGLES,
+        static_cast<GLsizei>(indexCount),
+        GL_UNSIGNED_INT, nullptr,
+        static_cast<GLsizei>(instanceCount));
+    RenderState::countDraw();
 }
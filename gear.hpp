@@ -12,7 +12,7 @@
  * Prosta klasa Gear generująca low-poly koło zębate.
  * Geometria zawiera pozycje (vec4), normalne (vec4) i kolory (vec4).
  * Rysowanie odbywa się przez wywołanie draw(), pod warunkiem że przedtem
- * w głównym kodzie ustawiono uniformy P, V, M, lp w shaderze.
+ * w głównym kodzie ustawiono uniform M, a blok Camera jest aktualny.
  */
 class Gear {
 public:
@@ -28,6 +28,13 @@ public:
     /// Rysuje koło zębate (zakłada, że uniform M jest już ustawiony).
     void draw();
 
+    /// Ustawia macierze modelu instancji (wysyłane raz, do ponownego użycia w drawInstanced).
+    void setInstances(const std::vector<glm::mat4>& models);
+
+    /// Rysuje koło zębate raz na każdą macierz z setInstances jednym wywołaniem
+    /// (wymaga shadera v_instanced.glsl zamiast uniformu M).
+    void drawInstanced();
+
     /// Dostęp do liczby zębów (w synchronizacji koła B względem A).
     int getTeethCount() const { return teethCount; }
 
@@ -40,6 +47,12 @@ public:
     /// Zwrot wartości rpm (tylko gdy chcemy odczytać prędkość).
     float getRPM() const { return rpm; }
 
+    /// Geometria w pamięci CPU (do spakowania w MeshArena).
+    const std::vector<glm::vec4>& getVertices() const { return vertices; }
+    const std::vector<glm::vec4>& getNormals() const { return normals; }
+    const std::vector<glm::vec4>& getColors() const { return colors; }
+    const std::vector<GLuint>& getIndices() const { return indices; }
+
 private:
     void buildGeometry();
 
@@ -52,6 +65,8 @@ private:
     GLuint vbo;
     GLuint ebo;
     size_t indexCount;
+    GLuint instanceVbo;   // macierze modelu instancji (0 = brak)
+    size_t instanceCount;
 
     // Bufory geometrii
     std::vector<glm::vec4> vertices; // (x, y, z, 1)
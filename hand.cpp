@@ -1,10 +1,12 @@
 ﻿// src/hand.cpp
 #include "hand.hpp"
+#include "instancing.hpp"
+#include "render_state.hpp"
 #include <iostream>
 
 Hand::Hand(float length, float thickness)
     : len(length), thick(thickness),
-    vao(0), vbo(0), ebo(0), indexCount(0)
+    vao(0), vbo(0), ebo(0), indexCount(0), instanceVbo(0), instanceCount(0)
 {
     buildGeometry();
 
@@ -12,7 +14,7 @@ Hand::Hand(float length, float thickness)
     glGenBuffers(1, &vbo);
     glGenBuffers(1, &ebo);
 
-    glBindVertexArray(vao);
+    RenderState::bindVertexArray(vao);
 
     // Interleaved: [pos (4)] [normal (4)] [color (4)]
     std::vector<float> interleaved;
@@ -35,7 +37,7 @@ Hand::Hand(float length, float thickness)
         interleaved.push_back(colors[i].w);
     }
 
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    RenderState::bindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferData(GL_ARRAY_BUFFER,
         interleaved.size() * sizeof(float),
         interleaved.data(),
@@ -56,14 +58,14 @@ Hand::Hand(float length, float thickness)
     glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (void*)((4 + 4) * sizeof(float)));
     glEnableVertexAttribArray(1);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    RenderState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER,
         indices.size() * sizeof(GLuint),
         indices.data(),
         GL_STATIC_DRAW);
 
     indexCount = indices.size();
-    glBindVertexArray(0);
+    RenderState::bindVertexArray(0);
 
     std::cout << "[Hand] VAO=" << vao << " VBO=" << vbo
         << " EBO=" << ebo << " indices=" << indexCount << "\n";
@@ -71,9 +73,10 @@ Hand::Hand(float length, float thickness)
 
 Hand::~Hand()
 {
-    if (ebo) glDeleteBuffers(1, &ebo);
-    if (vbo) glDeleteBuffers(1, &vbo);
-    if (vao) glDeleteVertexArrays(1, &vao);
+    if (instanceVbo) RenderState::deleteBuffer(instanceVbo);
+    if (ebo) RenderState::deleteBuffer(ebo);
+    if (vbo) RenderState::deleteBuffer(vbo);
+    if (vao) RenderState::deleteVertexArray(vao);
 }
 
 void Hand::buildGeometry()
@@ -109,9 +112,26 @@ void Hand::buildGeometry()
 
 void Hand::draw()
 {
-    glBindVertexArray(vao);
+    RenderState::bindVertexArray(vao);
     glDrawElements(GL_TRIANGLES,
         static_cast<GLsizei>(indexCount),
         GL_UNSIGNED_INT, nullptr);
-    glBindVertexArray(0);
+    RenderState::countDraw();
+}
+
+void Hand::setInstances(const std::vector<glm::mat4>& models)
+{
+    instanceVbo = uploadInstanceMatrices(vao, instanceVbo, models);
+    instanceCount = models.size();
+}
+
+void Hand::drawInstanced()
+{
+    if (instanceCount == 0) return;
+    RenderState::bindVertexArray(vao);
+    glDrawElementsInstanced(GL_TRIANGLES,
+        static_cast<GLsizei>(indexCount),
+        GL_UNSIGNED_INT, nullptr,
+        static_cast<GLsizei>(instanceCount));
+    RenderState::countDraw();
 }
@@ -20,9 +20,22 @@ public:
     Hand(float length, float thickness);
     ~Hand();
 
-    /// Rysuje wskazówkę (zakłada, że uniform M już ustawiony oraz P, V).
+    /// Rysuje wskazówkę (zakłada, że uniform M jest ustawiony, a blok Camera aktualny).
     void draw();
 
+    /// Ustawia macierze modelu instancji (wysyłane raz, do ponownego użycia w drawInstanced).
+    void setInstances(const std::vector<glm::mat4>& models);
+
+    /// Rysuje wskazówkę raz na każdą macierz z setInstances jednym wywołaniem
+    /// (wymaga shadera v_instanced.glsl zamiast uniformu M).
+    void drawInstanced();
+
+    /// Geometria w pamięci CPU (do spakowania w MeshArena).
+    const std::vector<glm::vec4>& getVertices() const { return vertices; }
+    const std::vector<glm::vec4>& getNormals() const { return normals; }
+    const std::vector<glm::vec4>& getColors() const { return colors; }
+    const std::vector<GLuint>& getIndices() const { return indices; }
+
 private:
     void buildGeometry();
 
@@ -33,6 +46,8 @@ private:
     GLuint vbo;
     GLuint ebo;
     size_t indexCount;
+    GLuint instanceVbo;   // macierze modelu instancji (0 = brak)
+    size_t instanceCount;
 
     std::vector<glm::vec4> vertices;
     std::vector<glm::vec4> normals;
@@ -0,0 +1,28 @@
+﻿// src/instancing.cpp
+#include "instancing.hpp"
+#include "render_state.hpp"
+
+GLuint uploadInstanceMatrices(GLuint vao, GLuint buffer, const std::vector<glm::mat4>& models)
+{
+    if (!buffer) glGenBuffers(1, &buffer);
+
+    RenderState::bindVertexArray(vao);
+    RenderState::bindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER,
+        models.size() * sizeof(glm::mat4),
+        models.data(),
+        GL_STATIC_DRAW);
+
+    // mat4 jako atrybut to cztery kolumny vec4 w kolejnych lokalizacjach
+    GLsizei stride = sizeof(glm::mat4);
+    for (GLuint col = 0; col < 4; ++col) {
+        GLuint loc = INSTANCE_MATRIX_LOCATION + col;
+        glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, stride, (void*)(col * sizeof(glm::vec4)));
+        glEnableVertexAttribArray(loc);
+        glVertexAttribDivisor(loc, 1);
+    }
+
+    RenderState::bindVertexArray(0);
+    RenderState::bindBuffer(GL_ARRAY_BUFFER, 0);
+    return buffer;
+}
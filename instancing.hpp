@@ -0,0 +1,19 @@
+﻿// include/instancing.hpp
+#ifndef INSTANCING_HPP
+#define INSTANCING_HPP
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <GL/glew.h>
+
+/// Pierwsza lokalizacja atrybutu instanceM w v_instanced.glsl (mat4 zajmuje 3..6).
+const GLuint INSTANCE_MATRIX_LOCATION = 3;
+
+/**
+ * Wysyła macierze modelu do bufora instancji (tworzy go, gdy buffer == 0)
+ * i podpina go do vao jako atrybut instanceM z dzielnikiem 1 – jedna
+ * macierz na instancję. Zwraca uchwyt bufora.
+ */
+GLuint uploadInstanceMatrices(GLuint vao, GLuint buffer, const std::vector<glm::mat4>& models);
+
+#endif // INSTANCING_HPP
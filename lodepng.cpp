@@ -28,15 +28,59 @@ The manual and changelog are in the header file "lodepng.h"
 Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for C.
 */
 
+/*mmap, pthreads and friends are POSIX, which strict C89 compilation otherwise hides*/
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include "lodepng.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 
+#if (defined(LODEPNG_COMPILE_DISK) && defined(LODEPNG_COMPILE_MMAP)) || defined(LODEPNG_COMPILE_THREADS)
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif /*_WIN32*/
+#endif /*(defined(LODEPNG_COMPILE_DISK) && defined(LODEPNG_COMPILE_MMAP)) || defined(LODEPNG_COMPILE_THREADS)*/
+
+#if defined(LODEPNG_COMPILE_DISK) && defined(LODEPNG_COMPILE_MMAP) && !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif /*defined(LODEPNG_COMPILE_DISK) && defined(LODEPNG_COMPILE_MMAP) && !defined(_WIN32)*/
+
+#if defined(LODEPNG_COMPILE_THREADS) && !defined(_WIN32)
+#include <pthread.h>
+#endif /*defined(LODEPNG_COMPILE_THREADS) && !defined(_WIN32)*/
+
 #ifdef LODEPNG_COMPILE_CPP
 #include <fstream>
 #endif /*LODEPNG_COMPILE_CPP*/
 
+#ifdef LODEPNG_COMPILE_SSE2
+#include <emmintrin.h>
+/*Kernels for extensions beyond SSE2 are compiled in per function and only called
+after lodepng_cpu_features confirmed the running CPU supports them.*/
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#define LODEPNG_COMPILE_CPU_DISPATCH
+#define LODEPNG_TARGET_SSSE3
+#define LODEPNG_TARGET_AVX2
+#elif (defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define LODEPNG_COMPILE_CPU_DISPATCH
+#define LODEPNG_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define LODEPNG_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif /*LODEPNG_COMPILE_SSE2*/
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -83,6 +127,194 @@ void* lodepng_realloc(void* ptr, size_t new_size);
 void lodepng_free(void* ptr);
 #endif /*LODEPNG_COMPILE_ALLOCATORS*/
 
+/*
+Allocation from a LodePNGArena, with arena 0 these are the functions above. Every
+block starts with a header that holds its size, the memory of the last block goes
+back to the arena when it's freed or can grow in place, which covers the vectors
+that are filled one after another. Allocations that don't fit come from the heap;
+arena_free and arena_realloc tell both apart by the address.
+*/
+#define ARENA_ALIGN (2 * sizeof(size_t)) /*size of the header, and alignment of the blocks*/
+
+static int arena_owns(const LodePNGArena* arena, const void* ptr)
+{
+  const unsigned char* p = (const unsigned char*)ptr;
+  return arena && p >= arena->data && p < arena->data + arena->capacity;
+}
+
+static size_t arena_block_size(const void* ptr)
+{
+  size_t size;
+  memcpy(&size, (const unsigned char*)ptr - ARENA_ALIGN, sizeof(size_t));
+  return size;
+}
+
+/*whether ptr is the last block of the arena*/
+static int arena_is_last(const LodePNGArena* arena, const void* ptr)
+{
+  size_t end = (size_t)((const unsigned char*)ptr - arena->data) + arena_block_size(ptr);
+  return (end + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN == arena->used;
+}
+
+static void* arena_malloc(LodePNGArena* arena, size_t size)
+{
+  size_t rounded, start;
+  if(!arena) return lodepng_malloc(size);
+  if(size > arena->capacity) return lodepng_malloc(size);
+  rounded = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+  if(rounded + ARENA_ALIGN > arena->capacity - arena->used) return lodepng_malloc(size); /*full*/
+  start = arena->used + ARENA_ALIGN;
+  memcpy(arena->data + arena->used, &size, sizeof(size_t));
+  arena->used = start + rounded;
+  if(arena->used > arena->peak) arena->peak = arena->used;
+  return arena->data + start;
+}
+
+static void arena_free(LodePNGArena* arena, void* ptr)
+{
+  if(!arena_owns(arena, ptr)) lodepng_free(ptr);
+  else if(arena_is_last(arena, ptr)) arena->used = (size_t)((unsigned char*)ptr - arena->data) - ARENA_ALIGN;
+}
+
+static void* arena_realloc(LodePNGArena* arena, void* ptr, size_t new_size)
+{
+  size_t oldsize;
+  void* result;
+  if(!ptr) return arena_malloc(arena, new_size);
+  if(!arena_owns(arena, ptr)) return lodepng_realloc(ptr, new_size);
+
+  oldsize = arena_block_size(ptr);
+  if(arena_is_last(arena, ptr))
+  {
+    size_t start = (size_t)((unsigned char*)ptr - arena->data);
+    if(new_size <= arena->capacity - start)
+    {
+      size_t end = start + (new_size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+      if(end <= arena->capacity)
+      {
+        memcpy((unsigned char*)ptr - ARENA_ALIGN, &new_size, sizeof(size_t));
+        arena->used = end;
+        if(arena->used > arena->peak) arena->peak = arena->used;
+        return ptr;
+      }
+    }
+  }
+  if(new_size <= oldsize) return ptr;
+
+  result = arena_malloc(arena, new_size);
+  if(!result) return 0; /*like realloc, the old block stays valid*/
+  memcpy(result, ptr, oldsize);
+  arena_free(arena, ptr);
+  return result;
+}
+
+unsigned lodepng_arena_init(LodePNGArena* arena, size_t capacity)
+{
+  arena->data = (unsigned char*)lodepng_malloc(capacity);
+  arena->capacity = arena->data ? capacity : 0;
+  arena->used = arena->peak = 0;
+  arena->owned = 1;
+  return (arena->data || !capacity) ? 0 : 83; /*alloc fail*/
+}
+
+void lodepng_arena_init_buffer(LodePNGArena* arena, void* buffer, size_t capacity)
+{
+  arena->data = (unsigned char*)buffer;
+  arena->capacity = buffer ? capacity : 0;
+  arena->used = arena->peak = 0;
+  arena->owned = 0;
+}
+
+void lodepng_arena_reset(LodePNGArena* arena)
+{
+  arena->used = 0;
+}
+
+void lodepng_arena_cleanup(LodePNGArena* arena)
+{
+  if(arena->owned) lodepng_free(arena->data);
+  arena->data = 0;
+  arena->capacity = arena->used = 0;
+}
+
+#ifdef LODEPNG_COMPILE_CPU_DISPATCH
+/*flags returned by lodepng_cpu_features*/
+#define LODEPNG_CPU_SSSE3 1u
+#define LODEPNG_CPU_AVX2 2u
+
+/*regs receives eax, ebx, ecx and edx of the cpuid instruction*/
+static void lodepng_cpuid(unsigned regs[4], unsigned leaf, unsigned subleaf)
+{
+#if defined(_MSC_VER)
+  int r[4];
+  __cpuidex(r, (int)leaf, (int)subleaf);
+  regs[0] = (unsigned)r[0]; regs[1] = (unsigned)r[1]; regs[2] = (unsigned)r[2]; regs[3] = (unsigned)r[3];
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/*the register state the OS saves on context switches, bits 1 and 2 mean SSE and AVX registers*/
+static unsigned lodepng_xgetbv(void)
+{
+#if defined(_MSC_VER)
+  return (unsigned)_xgetbv(0);
+#else
+  unsigned eax, edx;
+  __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return eax;
+#endif
+}
+
+/*set in the cached flags once they are known, so that a cache of 0 means "not detected yet"*/
+#define LODEPNG_CPU_KNOWN 256u
+
+/*Runs cpuid and xgetbv, which is slow (in a VM each cpuid traps to the hypervisor).*/
+static unsigned lodepng_cpu_detect(void)
+{
+  unsigned regs[4];
+  unsigned maxleaf, result = 0;
+  lodepng_cpuid(regs, 0, 0);
+  maxleaf = regs[0];
+  if(maxleaf < 1) return 0;
+  lodepng_cpuid(regs, 1, 0);
+  if(regs[2] & (1u << 9)) result |= LODEPNG_CPU_SSSE3;
+  /*AVX2 needs the OSXSAVE and AVX bits, and the OS saving the AVX registers*/
+  if(maxleaf >= 7 && (regs[2] & (1u << 27)) && (regs[2] & (1u << 28)) && (lodepng_xgetbv() & 6u) == 6u)
+  {
+    lodepng_cpuid(regs, 7, 0);
+    if(regs[1] & (1u << 5)) result |= LODEPNG_CPU_AVX2;
+  }
+  return result;
+}
+
+/*Returns the LODEPNG_CPU_ flags of the extensions that the CPU and OS support. Detected
+on the first call and cached, since the Adler-32 and color conversion code ask per
+update and per row. Threads racing on the first call all detect and store the same
+value, the atomic load and store only keep that race well defined.*/
+static unsigned lodepng_cpu_features(void)
+{
+#if defined(_MSC_VER)
+  static volatile long cached = 0;
+  unsigned flags = (unsigned)_InterlockedOr(&cached, 0);
+  if(!(flags & LODEPNG_CPU_KNOWN))
+  {
+    flags = lodepng_cpu_detect() | LODEPNG_CPU_KNOWN;
+    _InterlockedExchange(&cached, (long)flags);
+  }
+#else
+  static unsigned cached = 0;
+  unsigned flags = __atomic_load_n(&cached, __ATOMIC_RELAXED);
+  if(!(flags & LODEPNG_CPU_KNOWN))
+  {
+    flags = lodepng_cpu_detect() | LODEPNG_CPU_KNOWN;
+    __atomic_store_n(&cached, flags, __ATOMIC_RELAXED);
+  }
+#endif
+  return flags & ~LODEPNG_CPU_KNOWN;
+}
+#endif /*LODEPNG_COMPILE_CPU_DISPATCH*/
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* ////////////////////////////////////////////////////////////////////////// */
 /* // Tools for C, and common code for PNG and Zlib.                       // */
@@ -210,6 +442,7 @@ typedef struct ucvector
   unsigned char* data;
   size_t size; /*used size*/
   size_t allocsize; /*allocated size*/
+  LodePNGArena* arena; /*where data is allocated, 0 for the heap*/
 } ucvector;
 
 /*returns 1 if success, 0 if failure ==> nothing done*/
@@ -218,7 +451,7 @@ static unsigned ucvector_reserve(ucvector* p, size_t allocsize)
   if(allocsize > p->allocsize)
   {
     size_t newsize = (allocsize > p->allocsize * 2) ? allocsize : (allocsize * 3 / 2);
-    void* data = lodepng_realloc(p->data, newsize);
+    void* data = arena_realloc(p->arena, p->data, newsize);
     if(data)
     {
       p->allocsize = newsize;
@@ -242,7 +475,7 @@ static unsigned ucvector_resize(ucvector* p, size_t size)
 static void ucvector_cleanup(void* p)
 {
   ((ucvector*)p)->size = ((ucvector*)p)->allocsize = 0;
-  lodepng_free(((ucvector*)p)->data);
+  arena_free(((ucvector*)p)->arena, ((ucvector*)p)->data);
   ((ucvector*)p)->data = NULL;
 }
 
@@ -250,7 +483,17 @@ static void ucvector_init(ucvector* p)
 {
   p->data = NULL;
   p->size = p->allocsize = 0;
+  p->arena = 0;
+}
+
+#ifdef LODEPNG_COMPILE_DECODER
+/*init a vector that allocates from the arena, which may be 0*/
+static void ucvector_init_arena(ucvector* p, LodePNGArena* arena)
+{
+  ucvector_init(p);
+  p->arena = arena;
 }
+#endif /*LODEPNG_COMPILE_DECODER*/
 #endif /*LODEPNG_COMPILE_PNG*/
 
 #ifdef LODEPNG_COMPILE_ZLIB
@@ -260,6 +503,7 @@ static void ucvector_init_buffer(ucvector* p, unsigned char* buffer, size_t size
 {
   p->data = buffer;
   p->allocsize = p->size = size;
+  p->arena = 0;
 }
 #endif /*LODEPNG_COMPILE_ZLIB*/
 
@@ -388,6 +632,136 @@ unsigned lodepng_save_file(const unsigned char* buffer, size_t buffersize, const
   return 0;
 }
 
+#if defined(LODEPNG_COMPILE_MMAP) && !defined(_WIN32)
+/*reads everything from the file descriptor, for files that can't be mapped*/
+static unsigned readFileDescriptor(LodePNGFileMap* map, int fd)
+{
+  unsigned char* data = 0;
+  size_t size = 0, allocsize = 0;
+  for(;;)
+  {
+    ssize_t amount;
+    if(size == allocsize)
+    {
+      size_t newsize = allocsize ? allocsize * 2 : 65536;
+      unsigned char* newdata = (unsigned char*)lodepng_realloc(data, newsize);
+      if(!newdata)
+      {
+        lodepng_free(data);
+        return 83; /*alloc fail*/
+      }
+      data = newdata;
+      allocsize = newsize;
+    }
+    amount = read(fd, data + size, allocsize - size);
+    if(amount < 0)
+    {
+      lodepng_free(data);
+      return 78;
+    }
+    if(amount == 0) break;
+    size += (size_t)amount;
+  }
+  map->data = data;
+  map->size = size;
+  return 0;
+}
+#endif /*defined(LODEPNG_COMPILE_MMAP) && !defined(_WIN32)*/
+
+#if !defined(LODEPNG_COMPILE_MMAP) || defined(_WIN32)
+/*reads the file into an allocated buffer, where it can't be mapped*/
+static unsigned loadFileIntoMap(LodePNGFileMap* map, const char* filename)
+{
+  unsigned char* buffer;
+  size_t buffersize;
+  unsigned error = lodepng_load_file(&buffer, &buffersize, filename);
+  map->data = buffer;
+  map->size = buffersize;
+  return error;
+}
+#endif /*!defined(LODEPNG_COMPILE_MMAP) || defined(_WIN32)*/
+
+unsigned lodepng_map_file(LodePNGFileMap* map, const char* filename)
+{
+#if defined(LODEPNG_COMPILE_MMAP) && defined(_WIN32)
+  HANDLE file;
+  LARGE_INTEGER filesize;
+
+  map->data = 0;
+  map->size = 0;
+  map->mapped = 0;
+
+  file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if(file == INVALID_HANDLE_VALUE) return 78;
+  /*an empty file can't be mapped, it goes through the fallback*/
+  if(GetFileSizeEx(file, &filesize) && filesize.QuadPart > 0
+     && (ULONGLONG)filesize.QuadPart <= (ULONGLONG)(size_t)(-1))
+  {
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mapping)
+    {
+      /*the view keeps the mapping alive, the handles aren't needed anymore*/
+      void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+      if(data)
+      {
+        CloseHandle(file);
+        map->data = (const unsigned char*)data;
+        map->size = (size_t)filesize.QuadPart;
+        map->mapped = 1;
+        return 0;
+      }
+    }
+  }
+  CloseHandle(file);
+  return loadFileIntoMap(map, filename);
+#elif defined(LODEPNG_COMPILE_MMAP)
+  int fd;
+  struct stat st;
+  unsigned error;
+
+  map->data = 0;
+  map->size = 0;
+  map->mapped = 0;
+
+  fd = open(filename, O_RDONLY);
+  if(fd < 0) return 78;
+  /*an empty or special file can't be mapped, it is read instead*/
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+     && (off_t)(size_t)st.st_size == st.st_size)
+  {
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data != MAP_FAILED)
+    {
+      close(fd);
+      map->data = (const unsigned char*)data;
+      map->size = (size_t)st.st_size;
+      map->mapped = 1;
+      return 0;
+    }
+  }
+  error = readFileDescriptor(map, fd);
+  close(fd);
+  return error;
+#else /*LODEPNG_COMPILE_MMAP*/
+  map->mapped = 0;
+  return loadFileIntoMap(map, filename);
+#endif /*LODEPNG_COMPILE_MMAP*/
+}
+
+void lodepng_unmap_file(LodePNGFileMap* map)
+{
+#if defined(LODEPNG_COMPILE_MMAP) && defined(_WIN32)
+  if(map->mapped) UnmapViewOfFile(map->data);
+#elif defined(LODEPNG_COMPILE_MMAP)
+  if(map->mapped) munmap((void*)map->data, map->size);
+#endif /*LODEPNG_COMPILE_MMAP*/
+  if(!map->mapped) lodepng_free((void*)map->data);
+  map->data = 0;
+  map->size = 0;
+  map->mapped = 0;
+}
+
 #endif /*LODEPNG_COMPILE_DISK*/
 
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -423,25 +797,91 @@ static void addBitsToStreamReversed(size_t* bitpointer, ucvector* bitstream, uns
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-#define READBIT(bitpointer, bitstream) ((bitstream[bitpointer >> 3] >> (bitpointer & 0x7)) & (unsigned char)1)
+/*
+Reads the deflate bit stream. Whole bytes are loaded into a size_t bit buffer
+at once, so the bounds check against the input happens once per refill rather
+than once per bit. The next bit of the stream is always the lsb of buffer.
+*/
+typedef struct LodePNGBitReader
+{
+  const unsigned char* data;
+  size_t size; /*size of data in bytes*/
+  size_t bitsize; /*size of data in bits, reading past this is an error the callers check with bp*/
+  size_t bp; /*amount of bits consumed so far*/
+  size_t buffer; /*loaded bits that are not consumed yet*/
+  unsigned bufferbits; /*amount of valid bits in buffer, bp + bufferbits is always a multiple of 8*/
+} LodePNGBitReader;
 
-static unsigned char readBitFromStream(size_t* bitpointer, const unsigned char* bitstream)
+static void LodePNGBitReader_init(LodePNGBitReader* reader, const unsigned char* data, size_t size)
 {
-  unsigned char result = (unsigned char)(READBIT(*bitpointer, bitstream));
-  ++(*bitpointer);
-  return result;
+  reader->data = data;
+  reader->size = size;
+  reader->bitsize = size * 8;
+  reader->bp = 0;
+  reader->buffer = 0;
+  reader->bufferbits = 0;
 }
 
-static unsigned readBitsFromStream(size_t* bitpointer, const unsigned char* bitstream, size_t nbits)
+/*
+Makes sure at least nbits bits are in the buffer. nbits must be at most 25, the
+amount a 32-bit buffer is guaranteed to hold after a refill. Bytes past the end
+of the input are loaded as 0, callers detect reading past the end by checking bp.
+*/
+static void ensureBits(LodePNGBitReader* reader, unsigned nbits)
 {
-  unsigned result = 0, i;
-  for(i = 0; i != nbits; ++i)
+  size_t next = (reader->bp + reader->bufferbits) >> 3; /*next byte to load*/
+  unsigned maxbits = (unsigned)(sizeof(size_t) * 8u) - 8u;
+  if(reader->bufferbits >= nbits) return;
+  if(next + sizeof(size_t) <= reader->size)
   {
-    result += ((unsigned)READBIT(*bitpointer, bitstream)) << i;
-    ++(*bitpointer);
+    while(reader->bufferbits <= maxbits)
+    {
+      reader->buffer |= (size_t)reader->data[next++] << reader->bufferbits;
+      reader->bufferbits += 8;
+    }
+  }
+  else
+  {
+    while(reader->bufferbits <= maxbits)
+    {
+      if(next < reader->size) reader->buffer |= (size_t)reader->data[next] << reader->bufferbits;
+      ++next;
+      reader->bufferbits += 8;
+    }
   }
+}
+
+/*returns the next nbits bits without consuming them, requires ensureBits with at least nbits*/
+static unsigned peekBits(const LodePNGBitReader* reader, unsigned nbits)
+{
+  return (unsigned)(reader->buffer & (((size_t)1u << nbits) - 1u));
+}
+
+/*consumes nbits bits, requires ensureBits with at least nbits*/
+static void advanceBits(LodePNGBitReader* reader, unsigned nbits)
+{
+  reader->buffer >>= nbits;
+  reader->bufferbits -= nbits;
+  reader->bp += nbits;
+}
+
+/*nbits must be at most 25*/
+static unsigned readBits(LodePNGBitReader* reader, unsigned nbits)
+{
+  unsigned result;
+  ensureBits(reader, nbits);
+  result = peekBits(reader, nbits);
+  advanceBits(reader, nbits);
   return result;
 }
+
+/*skips to the next byte boundary and empties the buffer, for reading whole bytes from data*/
+static void alignToByte(LodePNGBitReader* reader)
+{
+  reader->bp = (reader->bp + 7u) & ~(size_t)7u;
+  reader->buffer = 0;
+  reader->bufferbits = 0;
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -494,6 +934,11 @@ typedef struct HuffmanTree
   unsigned* lengths; /*the lengths of the codes of the 1d-tree*/
   unsigned maxbitlen; /*maximum number of bits a single code can get*/
   unsigned numcodes; /*number of symbols in the alphabet = number of codes*/
+  /*lookup table used by the decoder, indexed by the next FIRSTBITS bits of the stream. For a short
+  code, table_len is its bit length and table_value the symbol. For a code longer than FIRSTBITS,
+  table_len is the longest length sharing that prefix and table_value the start of its subtable.*/
+  unsigned char* table_len;
+  unsigned short* table_value;
 } HuffmanTree;
 
 /*function used for debug purposes to draw the tree in ascii art with C++*/
@@ -514,6 +959,8 @@ static void HuffmanTree_init(HuffmanTree* tree)
   tree->tree2d = 0;
   tree->tree1d = 0;
   tree->lengths = 0;
+  tree->table_len = 0;
+  tree->table_value = 0;
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree)
@@ -521,6 +968,8 @@ static void HuffmanTree_cleanup(HuffmanTree* tree)
   lodepng_free(tree->tree2d);
   lodepng_free(tree->tree1d);
   lodepng_free(tree->lengths);
+  lodepng_free(tree->table_len);
+  lodepng_free(tree->table_value);
 }
 
 /*the tree representation used by the decoder. return value is error*/
@@ -584,6 +1033,126 @@ static unsigned HuffmanTree_make2DTree(HuffmanTree* tree)
   return 0;
 }
 
+#ifdef LODEPNG_COMPILE_DECODER
+/*amount of bits resolved by the first level of the decoding lookup table*/
+#define FIRSTBITS 9u
+/*table_len value of entries that no valid code maps to, the decoder walks tree2d for those*/
+#define INVALIDBITLEN 16u
+
+static unsigned reverseBits(unsigned bits, unsigned num)
+{
+  unsigned i, result = 0;
+  for(i = 0; i != num; ++i) result |= ((bits >> (num - i - 1u)) & 1u) << i;
+  return result;
+}
+
+/*
+Builds the two level lookup table used by huffmanDecodeSymbol. Codes of at most
+FIRSTBITS bits are replicated over all first level entries they are a prefix of;
+longer codes get a second level table per first level prefix, sized for the
+longest code with that prefix. Deflate stores huffman codes MSB first while the
+stream is read LSB first, so all indices are the bit-reversed codes. Return value is error.
+An over-subscribed set of lengths gives colliding codes: its table is left with only
+INVALIDBITLEN entries, so the decoder walks tree2d and reports the same errors as before.
+*/
+static unsigned HuffmanTree_makeTable(HuffmanTree* tree)
+{
+  static const unsigned headsize = 1u << FIRSTBITS;
+  unsigned maxlens[1u << FIRSTBITS]; /*longest code length per first level prefix*/
+  size_t size, pointer, i;
+  unsigned n;
+  unsigned long kraft = 0; /*code space used, in units of 2^-maxbitlen*/
+
+  for(n = 0; n != tree->numcodes; ++n)
+  {
+    if(tree->lengths[n] != 0) kraft += 1ul << (tree->maxbitlen - tree->lengths[n]);
+  }
+  if(kraft > (1ul << tree->maxbitlen))
+  {
+    tree->table_len = (unsigned char*)lodepng_malloc(headsize * sizeof(unsigned char));
+    tree->table_value = (unsigned short*)lodepng_malloc(headsize * sizeof(unsigned short));
+    if(!tree->table_len || !tree->table_value) return 83; /*alloc fail*/
+    for(i = 0; i != headsize; ++i)
+    {
+      tree->table_len[i] = INVALIDBITLEN;
+      tree->table_value[i] = 0;
+    }
+    return 0;
+  }
+
+  for(i = 0; i != headsize; ++i) maxlens[i] = 0;
+  for(n = 0; n != tree->numcodes; ++n)
+  {
+    unsigned l = tree->lengths[n];
+    unsigned index;
+    if(l <= FIRSTBITS) continue;
+    /*tree1d codes are only meaningful in their lowest l bits*/
+    index = reverseBits((tree->tree1d[n] & ((1u << l) - 1u)) >> (l - FIRSTBITS), FIRSTBITS);
+    if(l > maxlens[index]) maxlens[index] = l;
+  }
+
+  size = headsize;
+  for(i = 0; i != headsize; ++i)
+  {
+    if(maxlens[i] > FIRSTBITS) size += (size_t)1u << (maxlens[i] - FIRSTBITS);
+  }
+
+  tree->table_len = (unsigned char*)lodepng_malloc(size * sizeof(unsigned char));
+  tree->table_value = (unsigned short*)lodepng_malloc(size * sizeof(unsigned short));
+  if(!tree->table_len || !tree->table_value) return 83; /*alloc fail*/
+
+  for(i = 0; i != size; ++i)
+  {
+    tree->table_len[i] = INVALIDBITLEN;
+    tree->table_value[i] = 0;
+  }
+
+  /*first level entries of long codes point to their second level table*/
+  pointer = headsize;
+  for(i = 0; i != headsize; ++i)
+  {
+    if(maxlens[i] <= FIRSTBITS) continue;
+    tree->table_len[i] = (unsigned char)maxlens[i];
+    tree->table_value[i] = (unsigned short)pointer;
+    pointer += (size_t)1u << (maxlens[i] - FIRSTBITS);
+  }
+
+  for(n = 0; n != tree->numcodes; ++n)
+  {
+    unsigned l = tree->lengths[n];
+    unsigned reverse, j, num;
+    if(l == 0) continue;
+    reverse = reverseBits(tree->tree1d[n] & ((1u << l) - 1u), l);
+    if(l <= FIRSTBITS)
+    {
+      /*the FIRSTBITS - l bits following a short code can have any value*/
+      num = 1u << (FIRSTBITS - l);
+      for(j = 0; j != num; ++j)
+      {
+        unsigned index = reverse | (j << l);
+        tree->table_len[index] = (unsigned char)l;
+        tree->table_value[index] = (unsigned short)n;
+      }
+    }
+    else
+    {
+      unsigned index = reverse & (headsize - 1u);
+      unsigned sublen = tree->table_len[index] - FIRSTBITS; /*log2 of the size of the second level table*/
+      unsigned start = tree->table_value[index];
+      num = 1u << (sublen - (l - FIRSTBITS));
+      for(j = 0; j != num; ++j)
+      {
+        unsigned index2 = start + ((reverse >> FIRSTBITS) | (j << (l - FIRSTBITS)));
+        tree->table_len[index2] = (unsigned char)l;
+        tree->table_value[index2] = (unsigned short)n;
+      }
+    }
+  }
+
+  return 0;
+}
+#endif /*LODEPNG_COMPILE_DECODER*/
+
 /*
 Second step for the ...makeFromLengths and ...makeFromFrequencies functions.
 numcodes, lengths and maxbitlen must already be filled in correctly. return
@@ -643,7 +1212,12 @@ static unsigned HuffmanTree_makeFromLengths(HuffmanTree* tree, const unsigned* b
   for(i = 0; i != numcodes; ++i) tree->lengths[i] = bitlen[i];
   tree->numcodes = (unsigned)numcodes; /*number of symbols*/
   tree->maxbitlen = maxbitlen;
+#ifdef LODEPNG_COMPILE_DECODER
+  CERROR_TRY_RETURN(HuffmanTree_makeFromLengths2(tree));
+  return HuffmanTree_makeTable(tree);
+#else /*LODEPNG_COMPILE_DECODER*/
   return HuffmanTree_makeFromLengths2(tree);
+#endif /*LODEPNG_COMPILE_DECODER*/
 }
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -905,28 +1479,44 @@ static unsigned generateFixedDistanceTree(HuffmanTree* tree)
 #ifdef LODEPNG_COMPILE_DECODER
 
 /*
+Decodes a symbol by walking tree2d one bit at a time. Used as fallback by
+huffmanDecodeSymbol near the end of the input and for bit patterns that are not
+a code of the tree, so that those keep their original error behavior.
 returns the code, or (unsigned)(-1) if error happened
-inbitlength is the length of the complete buffer, in bits (so its byte length times 8)
 */
-static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
-                                    const HuffmanTree* codetree, size_t inbitlength)
+static unsigned huffmanDecodeSymbolSlow(LodePNGBitReader* reader, const HuffmanTree* codetree)
 {
   unsigned treepos = 0, ct;
   for(;;)
   {
-    if(*bp >= inbitlength) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
-    /*
-    decode the symbol from the tree. The "readBitFromStream" code is inlined in
-    the expression below because this is the biggest bottleneck while decoding
-    */
-    ct = codetree->tree2d[(treepos << 1) + READBIT(*bp, in)];
-    ++(*bp);
+    if(reader->bp >= reader->bitsize) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
+    ensureBits(reader, 1);
+    ct = codetree->tree2d[(treepos << 1) + peekBits(reader, 1)];
+    advanceBits(reader, 1);
     if(ct < codetree->numcodes) return ct; /*the symbol is decoded, return it*/
     else treepos = ct - codetree->numcodes; /*symbol not yet decoded, instead move tree position*/
 
     if(treepos >= codetree->numcodes) return (unsigned)(-1); /*error: it appeared outside the codetree*/
   }
 }
+
+/*returns the code, or (unsigned)(-1) if error happened*/
+static unsigned huffmanDecodeSymbol(LodePNGBitReader* reader, const HuffmanTree* codetree)
+{
+  unsigned index, len;
+  ensureBits(reader, 15); /*the longest deflate code*/
+  index = peekBits(reader, FIRSTBITS);
+  len = codetree->table_len[index];
+  if(len > FIRSTBITS && len != INVALIDBITLEN)
+  {
+    /*long code: the bits after the first FIRSTBITS index the second level table*/
+    index = codetree->table_value[index] + ((peekBits(reader, len) >> FIRSTBITS));
+    len = codetree->table_len[index];
+  }
+  if(len == INVALIDBITLEN || reader->bp + len > reader->bitsize) return huffmanDecodeSymbolSlow(reader, codetree);
+  advanceBits(reader, len);
+  return codetree->table_value[index];
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_DECODER
@@ -945,12 +1535,11 @@ static void getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
 
 /*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
 static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
-                                      const unsigned char* in, size_t* bp, size_t inlength)
+                                      LodePNGBitReader* reader)
 {
   /*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated*/
   unsigned error = 0;
   unsigned n, HLIT, HDIST, HCLEN, i;
-  size_t inbitlength = inlength * 8;
 
   /*see comments in deflateDynamic for explanation of the context and these variables, it is analogous*/
   unsigned* bitlen_ll = 0; /*lit,len code lengths*/
@@ -959,16 +1548,16 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   unsigned* bitlen_cl = 0;
   HuffmanTree tree_cl; /*the code tree for code length codes (the huffman tree for compressed huffman trees)*/
 
-  if((*bp) + 14 > (inlength << 3)) return 49; /*error: the bit pointer is or will go past the memory*/
+  if(reader->bp + 14 > reader->bitsize) return 49; /*error: the bit pointer is or will go past the memory*/
 
   /*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already*/
-  HLIT =  readBitsFromStream(bp, in, 5) + 257;
+  HLIT =  readBits(reader, 5) + 257;
   /*number of distance codes. Unlike the spec, the value 1 is added to it here already*/
-  HDIST = readBitsFromStream(bp, in, 5) + 1;
+  HDIST = readBits(reader, 5) + 1;
   /*number of code length codes. Unlike the spec, the value 4 is added to it here already*/
-  HCLEN = readBitsFromStream(bp, in, 4) + 4;
+  HCLEN = readBits(reader, 4) + 4;
 
-  if((*bp) + HCLEN * 3 > (inlength << 3)) return 50; /*error: the bit pointer is or will go past the memory*/
+  if(reader->bp + HCLEN * 3 > reader->bitsize) return 50; /*error: the bit pointer is or will go past the memory*/
 
   HuffmanTree_init(&tree_cl);
 
@@ -981,7 +1570,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
     for(i = 0; i != NUM_CODE_LENGTH_CODES; ++i)
     {
-      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = readBitsFromStream(bp, in, 3);
+      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = readBits(reader, 3);
       else bitlen_cl[CLCL_ORDER[i]] = 0; /*if not, it must stay 0*/
     }
 
@@ -999,7 +1588,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     i = 0;
     while(i < HLIT + HDIST)
     {
-      unsigned code = huffmanDecodeSymbol(in, bp, &tree_cl, inbitlength);
+      unsigned code = huffmanDecodeSymbol(reader, &tree_cl);
       if(code <= 15) /*a length code*/
       {
         if(i < HLIT) bitlen_ll[i] = code;
@@ -1013,8 +1602,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
         if(i == 0) ERROR_BREAK(54); /*can't repeat previous if i is 0*/
 
-        if((*bp + 2) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 2);
+        if((reader->bp + 2) > reader->bitsize) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        replength += readBits(reader, 2);
 
         if(i < HLIT + 1) value = bitlen_ll[i - 1];
         else value = bitlen_d[i - HLIT - 1];
@@ -1030,8 +1619,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 17) /*repeat "0" 3-10 times*/
       {
         unsigned replength = 3; /*read in the bits that indicate repeat length*/
-        if((*bp + 3) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 3);
+        if((reader->bp + 3) > reader->bitsize) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        replength += readBits(reader, 3);
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; ++n)
@@ -1046,8 +1635,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 18) /*repeat "0" 11-138 times*/
       {
         unsigned replength = 11; /*read in the bits that indicate repeat length*/
-        if((*bp + 7) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 7);
+        if((reader->bp + 7) > reader->bitsize) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        replength += readBits(reader, 7);
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; ++n)
@@ -1065,7 +1654,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
         {
           /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
           (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inbitlength ? 10 : 11;
+          error = reader->bp > reader->bitsize ? 10 : 11;
         }
         else error = 16; /*unexisting code, this can never happen*/
         break;
@@ -1091,29 +1680,67 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   return error;
 }
 
+/*
+Copies a match of length bytes starting distance bytes before dst to dst. When
+the match overlaps its own output (distance < length) the data repeats with
+period distance, so it is copied in growing chunks that never overlap.
+*/
+static void copyMatch(unsigned char* dst, size_t distance, size_t length)
+{
+  size_t done, amount;
+  if(distance >= length)
+  {
+    memcpy(dst, dst - distance, length);
+    return;
+  }
+  if(distance == 1)
+  {
+    memset(dst, dst[-1], length);
+    return;
+  }
+  /*short periods, mostly from filtered scanlines, are copied bytewise until the chunks get worth a memcpy*/
+  if(distance < 8)
+  {
+    size_t end = length < 16 ? length : 16;
+    for(done = 0; done != end; ++done) dst[done] = dst[done - distance];
+    done -= done % distance;
+  }
+  else
+  {
+    memcpy(dst, dst - distance, distance);
+    done = distance;
+  }
+  /*dst[0..done) holds whole periods, so it can be reused as source for the next done bytes*/
+  while(done < length)
+  {
+    amount = length - done < done ? length - done : done;
+    memcpy(dst + done, dst, amount);
+    done += amount;
+  }
+}
+
 /*inflate a block with dynamic of fixed Huffman tree*/
-static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size_t* bp,
-                                    size_t* pos, size_t inlength, unsigned btype)
+static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
+                                    size_t* pos, unsigned btype)
 {
   unsigned error = 0;
   HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
   HuffmanTree tree_d; /*the huffman tree for distance codes*/
-  size_t inbitlength = inlength * 8;
 
   HuffmanTree_init(&tree_ll);
   HuffmanTree_init(&tree_d);
 
   if(btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
-  else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
+  else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, reader);
 
   while(!error) /*decode all symbols until end reached, breaks at end code*/
   {
     /*code_ll is literal, length or end code*/
-    unsigned code_ll = huffmanDecodeSymbol(in, bp, &tree_ll, inbitlength);
+    unsigned code_ll = huffmanDecodeSymbol(reader, &tree_ll);
     if(code_ll <= 255) /*literal symbol*/
     {
-      /*ucvector_push_back would do the same, but for some reason the two lines below run 10% faster*/
-      if(!ucvector_resize(out, (*pos) + 1)) ERROR_BREAK(83 /*alloc fail*/);
+      /*out->size is only updated at the end of the block, the output is written up to allocsize directly*/
+      if(*pos >= out->allocsize && !ucvector_reserve(out, (*pos) + 1)) ERROR_BREAK(83 /*alloc fail*/);
       out->data[*pos] = (unsigned char)code_ll;
       ++(*pos);
     }
@@ -1121,25 +1748,25 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
     {
       unsigned code_d, distance;
       unsigned numextrabits_l, numextrabits_d; /*extra bits for length and distance*/
-      size_t start, forward, backward, length;
+      size_t start, length;
 
       /*part 1: get length base*/
       length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
 
       /*part 2: get extra bits and add the value of that to length*/
       numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
-      if((*bp + numextrabits_l) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      length += readBitsFromStream(bp, in, numextrabits_l);
+      if((reader->bp + numextrabits_l) > reader->bitsize) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+      length += readBits(reader, numextrabits_l);
 
       /*part 3: get distance code*/
-      code_d = huffmanDecodeSymbol(in, bp, &tree_d, inbitlength);
+      code_d = huffmanDecodeSymbol(reader, &tree_d);
       if(code_d > 29)
       {
         if(code_ll == (unsigned)(-1)) /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
         {
           /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
           (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inlength * 8 ? 10 : 11;
+          error = reader->bp > reader->bitsize ? 10 : 11;
         }
         else error = 18; /*error: invalid distance code (30-31 are never used)*/
         break;
@@ -1148,24 +1775,16 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
 
       /*part 4: get extra bits from distance*/
       numextrabits_d = DISTANCEEXTRA[code_d];
-      if((*bp + numextrabits_d) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      distance += readBitsFromStream(bp, in, numextrabits_d);
+      if((reader->bp + numextrabits_d) > reader->bitsize) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+      distance += readBits(reader, numextrabits_d);
 
       /*part 5: fill in all the out[n] values based on the length and dist*/
       start = (*pos);
       if(distance > start) ERROR_BREAK(52); /*too long backward distance*/
-      backward = start - distance;
 
-      if(!ucvector_resize(out, (*pos) + length)) ERROR_BREAK(83 /*alloc fail*/);
-      if (distance < length) {
-        for(forward = 0; forward < length; ++forward)
-        {
-          out->data[(*pos)++] = out->data[backward++];
-        }
-      } else {
-        memcpy(out->data + *pos, out->data + backward, length);
-        *pos += length;
-      }
+      if((*pos) + length > out->allocsize && !ucvector_reserve(out, (*pos) + length)) ERROR_BREAK(83 /*alloc fail*/);
+      copyMatch(out->data + start, distance, length);
+      (*pos) += length;
     }
     else if(code_ll == 256)
     {
@@ -1175,25 +1794,29 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
     {
       /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
       (10=no endcode, 11=wrong jump outside of tree)*/
-      error = ((*bp) > inlength * 8) ? 10 : 11;
+      error = (reader->bp > reader->bitsize) ? 10 : 11;
       break;
     }
   }
 
+  out->size = *pos;
+
   HuffmanTree_cleanup(&tree_ll);
   HuffmanTree_cleanup(&tree_d);
 
   return error;
 }
 
-static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, size_t* bp, size_t* pos, size_t inlength)
+static unsigned inflateNoCompression(ucvector* out, LodePNGBitReader* reader, size_t* pos)
 {
   size_t p;
-  unsigned LEN, NLEN, n, error = 0;
+  unsigned LEN, NLEN, error = 0;
+  const unsigned char* in = reader->data;
+  size_t inlength = reader->size;
 
   /*go to first boundary of byte*/
-  while(((*bp) & 0x7) != 0) ++(*bp);
-  p = (*bp) / 8; /*byte position*/
+  alignToByte(reader);
+  p = reader->bp / 8; /*byte position*/
 
   /*read LEN (2 bytes) and NLEN (2 bytes)*/
   if(p + 4 >= inlength) return 52; /*error, bit pointer will jump past memory*/
@@ -1207,9 +1830,11 @@ static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, siz
 
   /*read the literal data: LEN bytes are now stored in the out buffer*/
   if(p + LEN > inlength) return 23; /*error: reading outside of in buffer*/
-  for(n = 0; n < LEN; ++n) out->data[(*pos)++] = in[p++];
+  if(LEN) memcpy(out->data + *pos, in + p, LEN);
+  (*pos) += LEN;
+  p += LEN;
 
-  (*bp) = p * 8;
+  reader->bp = p * 8;
 
   return error;
 }
@@ -1218,25 +1843,25 @@ static unsigned lodepng_inflatev(ucvector* out,
                                  const unsigned char* in, size_t insize,
                                  const LodePNGDecompressSettings* settings)
 {
-  /*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
-  size_t bp = 0;
   unsigned BFINAL = 0;
   size_t pos = 0; /*byte position in the out buffer*/
   unsigned error = 0;
+  LodePNGBitReader reader;
 
   (void)settings;
 
+  LodePNGBitReader_init(&reader, in, insize);
+
   while(!BFINAL)
   {
     unsigned BTYPE;
-    if(bp + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
-    BFINAL = readBitFromStream(&bp, in);
-    BTYPE = 1u * readBitFromStream(&bp, in);
-    BTYPE += 2u * readBitFromStream(&bp, in);
+    if(reader.bp + 2 >= reader.bitsize) return 52; /*error, bit pointer will jump past memory*/
+    BFINAL = readBits(&reader, 1);
+    BTYPE = readBits(&reader, 2);
 
     if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
-    else error = inflateHuffmanBlock(out, in, &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
+    else if(BTYPE == 0) error = inflateNoCompression(out, &reader, &pos); /*no compression*/
+    else error = inflateHuffmanBlock(out, &reader, &pos, BTYPE); /*compression, BTYPE 01 or 10*/
 
     if(error) return error;
   }
@@ -1403,6 +2028,24 @@ static unsigned getHash(const unsigned char* data, size_t size, size_t pos)
   return result & HASH_BIT_MASK;
 }
 
+/*Hash of 4 bytes, for when matches shorter than 4 aren't used anyway: less positions
+share a chain, so the chains are shorter. Zeros still hash to 0.*/
+static unsigned getHash4(const unsigned char* data, size_t size, size_t pos)
+{
+  unsigned value;
+  if(pos + 3 >= size) return getHash(data, size, pos);
+  value = (unsigned)data[pos + 0] | ((unsigned)data[pos + 1] << 8u)
+        | ((unsigned)data[pos + 2] << 16u) | ((unsigned)data[pos + 3] << 24u);
+  /*multiplicative hash, the top 16 bits of the product are the best mixed*/
+  return (((value * 2654435761u) & 0xffffffffu) >> 16u) & HASH_BIT_MASK;
+}
+
+/*getHash4 is opt-in: it changes the output of existing settings with minmatch >= 4*/
+static unsigned useHash4(const LodePNGCompressSettings* settings)
+{
+  return settings->hash4 && settings->minmatch >= 4;
+}
+
 static unsigned countZeros(const unsigned char* data, size_t size, size_t pos)
 {
   const unsigned char* start = data + pos;
@@ -1437,12 +2080,11 @@ this hash technique is one out of several ways to speed this up.
 */
 static unsigned encodeLZ77(uivector* out, Hash* hash,
                            const unsigned char* in, size_t inpos, size_t insize, unsigned windowsize,
-                           unsigned minmatch, unsigned nicematch, unsigned lazymatching)
+                           unsigned minmatch, unsigned nicematch, unsigned lazymatching, unsigned maxchainlength,
+                           unsigned hash4)
 {
   size_t pos;
   unsigned i, error = 0;
-  /*for large window lengths, assume the user wants no compression loss. Otherwise, max hash chain length speedup.*/
-  unsigned maxchainlength = windowsize >= 8192 ? windowsize : windowsize / 8;
   unsigned maxlazymatch = windowsize >= 8192 ? MAX_SUPPORTED_DEFLATE_LENGTH : 64;
 
   unsigned usezeros = 1; /*not sure if setting it to false for windowsize < 8192 is better or worse*/
@@ -1462,13 +2104,15 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
   if((windowsize & (windowsize - 1)) != 0) return 90; /*error: must be power of two*/
 
   if(nicematch > MAX_SUPPORTED_DEFLATE_LENGTH) nicematch = MAX_SUPPORTED_DEFLATE_LENGTH;
+  /*for large window lengths, assume the user wants no compression loss. Otherwise, max hash chain length speedup.*/
+  if(maxchainlength == 0) maxchainlength = windowsize >= 8192 ? windowsize : windowsize / 8;
 
   for(pos = inpos; pos < insize; ++pos)
   {
     size_t wpos = pos & (windowsize - 1); /*position for in 'circular' hash buffers*/
     unsigned chainlength = 0;
 
-    hashval = getHash(in, insize, pos);
+    hashval = hash4 ? getHash4(in, insize, pos) : getHash(in, insize, pos);
 
     if(usezeros && hashval == 0)
     {
@@ -1514,6 +2158,16 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
           foreptr += skip;
         }
 
+        /*compare a word at a time, then find the differing byte in the last one*/
+        while((size_t)(lastptr - foreptr) >= sizeof(size_t))
+        {
+          size_t fore, back;
+          memcpy(&fore, foreptr, sizeof(size_t));
+          memcpy(&back, backptr, sizeof(size_t));
+          if(fore != back) break;
+          backptr += sizeof(size_t);
+          foreptr += sizeof(size_t);
+        }
         while(foreptr != lastptr && *backptr == *foreptr) /*maximum supported length by deflate is max length*/
         {
           ++backptr;
@@ -1594,7 +2248,7 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
       {
         ++pos;
         wpos = pos & (windowsize - 1);
-        hashval = getHash(in, insize, pos);
+        hashval = hash4 ? getHash4(in, insize, pos) : getHash(in, insize, pos);
         if(usezeros && hashval == 0)
         {
           if(numzeros == 0) numzeros = countZeros(in, insize, pos);
@@ -1747,7 +2401,8 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
     if(settings->use_lz77)
     {
       error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                         settings->minmatch, settings->nicematch, settings->lazymatching);
+                         settings->minmatch, settings->nicematch, settings->lazymatching, settings->maxchainlength,
+                         useHash4(settings));
       if(error) break;
     }
     else
@@ -1957,7 +2612,8 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
     uivector lz77_encoded;
     uivector_init(&lz77_encoded);
     error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                       settings->minmatch, settings->nicematch, settings->lazymatching);
+                       settings->minmatch, settings->nicematch, settings->lazymatching, settings->maxchainlength,
+                       useHash4(settings));
     if(!error) writeLZ77data(bp, out, &lz77_encoded, &tree_ll, &tree_d);
     uivector_cleanup(&lz77_encoded);
   }
@@ -1978,6 +2634,16 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
   return error;
 }
 
+/*size of the dynamic deflate blocks to split insize bytes in*/
+static size_t dynamicBlockSize(size_t insize)
+{
+  /*on PNGs, deflate blocks of 65-262k seem to give most dense encoding*/
+  size_t blocksize = insize / 8 + 8;
+  if(blocksize < 65536) blocksize = 65536;
+  if(blocksize > 262144) blocksize = 262144;
+  return blocksize;
+}
+
 static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
                                  const LodePNGCompressSettings* settings)
 {
@@ -1989,13 +2655,7 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
   if(settings->btype > 2) return 61;
   else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
   else if(settings->btype == 1) blocksize = insize;
-  else /*if(settings->btype == 2)*/
-  {
-    /*on PNGs, deflate blocks of 65-262k seem to give most dense encoding*/
-    blocksize = insize / 8 + 8;
-    if(blocksize < 65536) blocksize = 65536;
-    if(blocksize > 262144) blocksize = 262144;
-  }
+  else /*if(settings->btype == 2)*/ blocksize = dynamicBlockSize(insize);
 
   numdeflateblocks = (insize + blocksize - 1) / blocksize;
   if(numdeflateblocks == 0) numdeflateblocks = 1;
@@ -2019,26 +2679,84 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
   return error;
 }
 
-unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
-                         const unsigned char* in, size_t insize,
-                         const LodePNGCompressSettings* settings)
+#ifdef LODEPNG_COMPILE_THREADS
+/*
+Deflates in[start, end) as dynamic blocks of blocksize, one part of the parallel
+compressor. The hash is first filled with the window before start, so the matches
+can still go back into the previous part. Unless final, the part ends with an empty
+stored block, which pads it to a whole byte: the parts can then simply be appended.
+*/
+static unsigned deflatePart(ucvector* out, const unsigned char* in, size_t start, size_t end,
+                            size_t blocksize, const LodePNGCompressSettings* settings, unsigned final)
 {
   unsigned error;
-  ucvector v;
-  ucvector_init_buffer(&v, *out, *outsize);
-  error = lodepng_deflatev(&v, in, insize, settings);
-  *out = v.data;
-  *outsize = v.size;
-  return error;
-}
+  unsigned numzeros = 0;
+  size_t pos;
+  size_t bp = 0; /*the bit pointer*/
+  Hash hash;
 
-static unsigned deflate(unsigned char** out, size_t* outsize,
-                        const unsigned char* in, size_t insize,
-                        const LodePNGCompressSettings* settings)
-{
-  if(settings->custom_deflate)
+  error = hash_init(&hash, settings->windowsize);
+  if(!error)
   {
-    return settings->custom_deflate(out, outsize, in, insize, settings);
+    /*the same hash updates encodeLZ77 does, with the part before start as the input*/
+    pos = start > settings->windowsize ? start - settings->windowsize : 0;
+    for(; pos < start; ++pos)
+    {
+      unsigned hashval = useHash4(settings) ? getHash4(in, start, pos) : getHash(in, start, pos);
+      if(hashval == 0)
+      {
+        if(numzeros == 0) numzeros = countZeros(in, start, pos);
+        else if(pos + numzeros > start || in[pos + numzeros - 1] != 0) --numzeros;
+      }
+      else
+      {
+        numzeros = 0;
+      }
+      updateHashChain(&hash, pos & (settings->windowsize - 1), hashval, numzeros);
+    }
+  }
+
+  for(pos = start; pos < end && !error; pos += blocksize)
+  {
+    size_t blockend = end - pos > blocksize ? pos + blocksize : end;
+    error = deflateDynamic(out, &bp, &hash, in, pos, blockend, settings, final && blockend == end);
+  }
+
+  if(!error && !final)
+  {
+    addBitsToStream(&bp, out, 0, 3); /*BFINAL 0 and BTYPE 00, the rest of the byte is padding*/
+    /*LEN 0 and NLEN 65535*/
+    ucvector_push_back(out, 0);
+    ucvector_push_back(out, 0);
+    ucvector_push_back(out, 255);
+    ucvector_push_back(out, 255);
+  }
+
+  hash_cleanup(&hash);
+  return error;
+}
+#endif /*LODEPNG_COMPILE_THREADS*/
+
+unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
+                         const unsigned char* in, size_t insize,
+                         const LodePNGCompressSettings* settings)
+{
+  unsigned error;
+  ucvector v;
+  ucvector_init_buffer(&v, *out, *outsize);
+  error = lodepng_deflatev(&v, in, insize, settings);
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+
+static unsigned deflate(unsigned char** out, size_t* outsize,
+                        const unsigned char* in, size_t insize,
+                        const LodePNGCompressSettings* settings)
+{
+  if(settings->custom_deflate)
+  {
+    return settings->custom_deflate(out, outsize, in, insize, settings);
   }
   else
   {
@@ -2052,10 +2770,119 @@ static unsigned deflate(unsigned char** out, size_t* outsize,
 /* / Adler32                                                                  */
 /* ////////////////////////////////////////////////////////////////////////// */
 
+#ifdef LODEPNG_COMPILE_CPU_DISPATCH
+/*
+Vectorized adler32 of len / 32 blocks of 32 bytes, the caller handles the rest.
+Per block, s1 grows by the byte sum and s2 by 32 * s1 plus the bytes weighted
+32..1. The per lane sums are reduced and taken modulo 65521 every 5536 bytes,
+before the 32-bit lanes can overflow.
+*/
+LODEPNG_TARGET_SSSE3
+static unsigned update_adler32_ssse3(unsigned adler, const unsigned char* data, unsigned len)
+{
+  unsigned s1 = adler & 0xffff;
+  unsigned s2 = (adler >> 16) & 0xffff;
+  unsigned blocks = len / 32;
+  const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+  const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+
+  while(blocks > 0)
+  {
+    unsigned n = blocks > 173 ? 173 : blocks; /*173 * 32 bytes stays below zlib's NMAX of 5552*/
+    __m128i v_ps = _mm_cvtsi32_si128((int)(s1 * n)); /*s1 is added to s2 once per block*/
+    __m128i v_s2 = _mm_cvtsi32_si128((int)s2);
+    __m128i v_s1 = zero;
+    blocks -= n;
+    do
+    {
+      __m128i bytes1 = _mm_loadu_si128((const __m128i*)data);
+      __m128i bytes2 = _mm_loadu_si128((const __m128i*)(data + 16));
+      v_ps = _mm_add_epi32(v_ps, v_s1);
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+      data += 32;
+    }
+    while(--n);
+    v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+    v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(2, 3, 0, 1)));
+    v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+    v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+    v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(v_s1)) % 65521;
+    s2 = (unsigned)_mm_cvtsi128_si32(v_s2) % 65521;
+  }
+
+  return (s2 << 16) | s1;
+}
+
+/*AVX2 version of update_adler32_ssse3, one 32 byte block per register*/
+LODEPNG_TARGET_AVX2
+static unsigned update_adler32_avx2(unsigned adler, const unsigned char* data, unsigned len)
+{
+  unsigned s1 = adler & 0xffff;
+  unsigned s2 = (adler >> 16) & 0xffff;
+  unsigned blocks = len / 32;
+  const __m256i tap = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                       16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+
+  while(blocks > 0)
+  {
+    unsigned n = blocks > 173 ? 173 : blocks;
+    __m256i v_ps = _mm256_setr_epi32((int)(s1 * n), 0, 0, 0, 0, 0, 0, 0);
+    __m256i v_s2 = _mm256_setr_epi32((int)s2, 0, 0, 0, 0, 0, 0, 0);
+    __m256i v_s1 = zero;
+    __m128i sum1, sum2;
+    blocks -= n;
+    do
+    {
+      __m256i bytes = _mm256_loadu_si256((const __m256i*)data);
+      v_ps = _mm256_add_epi32(v_ps, v_s1);
+      v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes, zero));
+      v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, tap), ones));
+      data += 32;
+    }
+    while(--n);
+    v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 5));
+    sum1 = _mm_add_epi32(_mm256_castsi256_si128(v_s1), _mm256_extracti128_si256(v_s1, 1));
+    sum2 = _mm_add_epi32(_mm256_castsi256_si128(v_s2), _mm256_extracti128_si256(v_s2, 1));
+    sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(sum1)) % 65521;
+    s2 = (unsigned)_mm_cvtsi128_si32(sum2) % 65521;
+  }
+
+  return (s2 << 16) | s1;
+}
+#endif /*LODEPNG_COMPILE_CPU_DISPATCH*/
+
 static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len)
 {
-   unsigned s1 = adler & 0xffff;
-   unsigned s2 = (adler >> 16) & 0xffff;
+   unsigned s1;
+   unsigned s2;
+
+#ifdef LODEPNG_COMPILE_CPU_DISPATCH
+  if(len >= 64)
+  {
+    unsigned features = lodepng_cpu_features();
+    unsigned vectorized = len & ~31u;
+    if(features & LODEPNG_CPU_AVX2) adler = update_adler32_avx2(adler, data, vectorized);
+    else if(features & LODEPNG_CPU_SSSE3) adler = update_adler32_ssse3(adler, data, vectorized);
+    else vectorized = 0;
+    data += vectorized;
+    len -= vectorized;
+  }
+#endif /*LODEPNG_COMPILE_CPU_DISPATCH*/
+
+  s1 = adler & 0xffff;
+  s2 = (adler >> 16) & 0xffff;
 
   while(len > 0)
   {
@@ -2087,13 +2914,11 @@ static unsigned adler32(const unsigned char* data, unsigned len)
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
-                                 size_t insize, const LodePNGDecompressSettings* settings)
+/*checks the 2-byte zlib header, returns error*/
+static unsigned readZlibHeader(const unsigned char* in)
 {
-  unsigned error = 0;
   unsigned CM, CINFO, FDICT;
 
-  if(insize < 2) return 53; /*error, size of zlib data too small*/
   /*read information from zlib header*/
   if((in[0] * 256 + in[1]) % 31 != 0)
   {
@@ -2118,6 +2943,17 @@ unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const uns
       "The additional flags shall not specify a preset dictionary."*/
     return 26;
   }
+  return 0;
+}
+
+unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
+                                 size_t insize, const LodePNGDecompressSettings* settings)
+{
+  unsigned error = 0;
+
+  if(insize < 2) return 53; /*error, size of zlib data too small*/
+  error = readZlibHeader(in);
+  if(error) return error;
 
   error = inflate(out, outsize, in + 2, insize - 2, settings);
   if(error) return error;
@@ -2145,10 +2981,311 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsi
   }
 }
 
+#ifdef LODEPNG_COMPILE_PNG
+/*
+Same as lodepng_zlib_decompress with the built-in inflate, but appends to a vector,
+so the memory reserved in it and its arena are used. Ignores custom_zlib and
+custom_inflate, the caller must handle those.
+*/
+static unsigned zlib_decompressv(ucvector* out, const unsigned char* in, size_t insize,
+                                 const LodePNGDecompressSettings* settings)
+{
+  if(insize < 2) return 53; /*error, size of zlib data too small*/
+  CERROR_TRY_RETURN(readZlibHeader(in));
+  CERROR_TRY_RETURN(lodepng_inflatev(out, in + 2, insize - 2, settings));
+
+  if(!settings->ignore_adler32)
+  {
+    unsigned ADLER32 = lodepng_read32bitInt(&in[insize - 4]);
+    unsigned checksum = adler32(out->data, (unsigned)(out->size));
+    if(checksum != ADLER32) return 58; /*error, adler checksum not correct, data must be corrupted*/
+  }
+  return 0; /*no error*/
+}
+#endif /*LODEPNG_COMPILE_PNG*/
+
+#ifdef LODEPNG_COMPILE_PNG
+/*
+Inflates a zlib stream of which the input arrives in parts, for the streaming PNG
+decoder. Output is produced per deflate block: a block is decoded once all its
+input is there, if the input runs out halfway, the output of the block is undone
+and it's decoded again when more data arrived. out holds the last 32K of output
+as window for the backward distances, plus whatever the user didn't take yet;
+ZlibStream_discard drops what's no longer needed. Custom zlib or inflate functions
+in the settings are not used, they can only handle the whole stream at once.
+*/
+typedef struct ZlibStream
+{
+  ucvector in; /*compressed data that isn't decoded yet, starting with the byte of bit bp*/
+  size_t bp; /*bit position of the next block in in*/
+  size_t retry; /*amount of bytes in must have before a block that ran out of input is tried again*/
+  ucvector out; /*decoded data: the window and the output not yet discarded*/
+  size_t outtotal; /*amount of bytes decoded since the start of the stream*/
+  unsigned adler;
+  unsigned header; /*whether the zlib header was read*/
+  unsigned final; /*whether the last block was decoded*/
+} ZlibStream;
+
+static void ZlibStream_init(ZlibStream* z)
+{
+  ucvector_init(&z->in);
+  ucvector_init(&z->out);
+  z->bp = z->retry = z->outtotal = 0;
+  z->adler = 1;
+  z->header = z->final = 0;
+}
+
+static void ZlibStream_cleanup(ZlibStream* z)
+{
+  ucvector_cleanup(&z->in);
+  ucvector_cleanup(&z->out);
+}
+
+/*
+Decodes all blocks for which the input is available. If complete is set, no more
+input will come and running out of input is an error. Returns error.
+*/
+static unsigned ZlibStream_inflate(ZlibStream* z, unsigned complete, const LodePNGDecompressSettings* settings)
+{
+  if(!z->header)
+  {
+    if(z->in.size < 2) return complete ? 53 : 0; /*error, size of zlib data too small*/
+    CERROR_TRY_RETURN(readZlibHeader(z->in.data));
+    z->header = 1;
+    z->bp = 16;
+  }
+
+  while(!z->final)
+  {
+    LodePNGBitReader reader;
+    unsigned BFINAL = 0, BTYPE, error = 0;
+    size_t start = z->out.size, pos = start, discard;
+
+    if(!complete && z->in.size < z->retry) return 0;
+
+    /*the reader starts at a byte, a block can start halfway one*/
+    LodePNGBitReader_init(&reader, z->in.data, z->in.size);
+    reader.bp = z->bp & ~(size_t)7u;
+    if(z->bp & 7u) readBits(&reader, (unsigned)(z->bp & 7u));
+    if(reader.bp + 2 >= reader.bitsize) error = 52; /*error, bit pointer will jump past memory*/
+    else
+    {
+      BFINAL = readBits(&reader, 1);
+      BTYPE = readBits(&reader, 2);
+      if(BTYPE == 3) error = 20; /*error: invalid BTYPE*/
+      else if(BTYPE == 0) error = inflateNoCompression(&z->out, &reader, &pos); /*no compression*/
+      else error = inflateHuffmanBlock(&z->out, &reader, &pos, BTYPE); /*compression, BTYPE 01 or 10*/
+    }
+
+    if(!complete && (error || reader.bp > reader.bitsize))
+    {
+      /*the block isn't complete yet: undo it, and wait until the available input doubled
+      so that a large block isn't decoded again for every small part of input*/
+      z->out.size = start;
+      z->retry = z->in.size + (z->in.size - z->bp / 8);
+      return 0;
+    }
+    if(error) return error;
+
+    if(!settings->ignore_adler32) z->adler = update_adler32(z->adler, &z->out.data[start], (unsigned)(pos - start));
+    z->outtotal += pos - start;
+    z->bp = reader.bp;
+    z->final = BFINAL;
+    z->retry = 0;
+
+    /*drop the input before the next block, but keep the last 4 bytes, they may be the adler32 checksum*/
+    discard = z->bp / 8;
+    if(z->in.size < 4) discard = 0;
+    else if(discard > z->in.size - 4) discard = z->in.size - 4;
+    if(discard)
+    {
+      memmove(z->in.data, &z->in.data[discard], z->in.size - discard);
+      z->in.size -= discard;
+      z->bp -= discard * 8;
+    }
+  }
+
+  if(complete && !settings->ignore_adler32)
+  {
+    if(z->in.size < 4) return 52; /*error, bit pointer will jump past memory*/
+    if(lodepng_read32bitInt(&z->in.data[z->in.size - 4]) != z->adler) return 58; /*error, adler checksum not correct*/
+  }
+  return 0;
+}
+
+/*
+Drops the output before out.data[used] that isn't needed as window anymore. Returns
+the amount of bytes removed from the front of out, used must be lowered by that.
+*/
+static size_t ZlibStream_discard(ZlibStream* z, size_t used)
+{
+  size_t drop = z->out.size > 32768 ? z->out.size - 32768 : 0;
+  if(drop > used) drop = used;
+  if(drop < 32768) return 0; /*only move the data once a fair amount can go*/
+  memmove(z->out.data, &z->out.data[drop], z->out.size - drop);
+  z->out.size -= drop;
+  return drop;
+}
+#endif /*LODEPNG_COMPILE_PNG*/
+
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
 
+#ifdef LODEPNG_COMPILE_THREADS
+/*
+The parallel compressor splits the input in as many parts as there are threads,
+made of whole dynamic blocks. Every thread deflates its part with deflatePart, and
+computes the adler32 of it. The parts are appended in order, and the adler32 values
+combined, which gives the same zlib stream as one thread would, apart from the empty
+stored blocks between the parts.
+*/
+
+typedef struct DeflateJob
+{
+  const unsigned char* in;
+  size_t start;
+  size_t end;
+  size_t blocksize;
+  const LodePNGCompressSettings* settings;
+  unsigned final;
+  ucvector out; /*the deflated part*/
+  unsigned adler; /*adler32 of in[start, end)*/
+  unsigned error;
+  unsigned started; /*whether the thread below is running this job*/
+#ifdef _WIN32
+  HANDLE thread;
+#else /*_WIN32*/
+  pthread_t thread;
+#endif /*_WIN32*/
+} DeflateJob;
+
+static void DeflateJob_run(DeflateJob* job)
+{
+  job->error = deflatePart(&job->out, job->in, job->start, job->end, job->blocksize, job->settings, job->final);
+  job->adler = update_adler32(1L, &job->in[job->start], (unsigned)(job->end - job->start));
+}
+
+#ifdef _WIN32
+static DWORD WINAPI DeflateJob_thread(LPVOID job)
+{
+  DeflateJob_run((DeflateJob*)job);
+  return 0;
+}
+#else /*_WIN32*/
+static void* DeflateJob_thread(void* job)
+{
+  DeflateJob_run((DeflateJob*)job);
+  return NULL;
+}
+#endif /*_WIN32*/
+
+/*
+Returns the adler32 of two parts after each other, given the adler32 of both and the
+length of the second: the first sums add up, and in the second sums every byte of
+the first part counts len2 times more.
+*/
+static unsigned adler32_combine(unsigned adler1, unsigned adler2, size_t len2)
+{
+  unsigned rem = (unsigned)(len2 % 65521);
+  unsigned s1 = adler1 & 0xffff;
+  unsigned s2 = (rem * s1) % 65521;
+  s1 += (adler2 & 0xffff) + 65521 - 1;
+  s2 += (adler1 >> 16) + (adler2 >> 16) + 65521 - rem;
+  if(s1 >= 65521) s1 -= 65521;
+  if(s1 >= 65521) s1 -= 65521;
+  if(s2 >= 65521 * 2) s2 -= 65521 * 2;
+  if(s2 >= 65521) s2 -= 65521;
+  return (s2 << 16) | s1;
+}
+
+/*whether deflateParallel is used: it needs dynamic blocks, at least two of them*/
+static unsigned useParallelDeflate(size_t insize, const LodePNGCompressSettings* settings)
+{
+  if(settings->numthreads < 2 || settings->btype != 2 || settings->custom_deflate) return 0;
+  /*leave invalid window sizes to the normal deflate, to give the error*/
+  if(settings->windowsize == 0 || settings->windowsize > 32768) return 0;
+  if((settings->windowsize & (settings->windowsize - 1)) != 0) return 0;
+  return insize > dynamicBlockSize(insize);
+}
+
+static unsigned deflateParallel(unsigned char** out, size_t* outsize, unsigned* adler,
+                                const unsigned char* in, size_t insize,
+                                const LodePNGCompressSettings* settings)
+{
+  unsigned error = 0;
+  size_t i;
+  size_t blocksize = dynamicBlockSize(insize);
+  size_t numblocks = (insize + blocksize - 1) / blocksize;
+  size_t numjobs = numblocks < settings->numthreads ? numblocks : settings->numthreads;
+  size_t partsize = (numblocks + numjobs - 1) / numjobs * blocksize;
+  DeflateJob* jobs;
+  ucvector v;
+
+  numjobs = (insize + partsize - 1) / partsize;
+  jobs = (DeflateJob*)lodepng_malloc(sizeof(DeflateJob) * numjobs);
+  if(!jobs) return 83; /*alloc fail*/
+
+  for(i = 0; i != numjobs; ++i)
+  {
+    DeflateJob* job = &jobs[i];
+    job->in = in;
+    job->start = i * partsize;
+    job->end = i + 1 == numjobs ? insize : job->start + partsize;
+    job->blocksize = blocksize;
+    job->settings = settings;
+    job->final = i + 1 == numjobs;
+    ucvector_init_buffer(&job->out, NULL, 0);
+    job->adler = 1;
+    job->error = 0;
+    job->started = 0;
+    /*the calling thread does the first part itself*/
+    if(i == 0) continue;
+#ifdef _WIN32
+    job->thread = CreateThread(NULL, 0, DeflateJob_thread, job, 0, NULL);
+    job->started = job->thread != NULL;
+#else /*_WIN32*/
+    job->started = !pthread_create(&job->thread, NULL, DeflateJob_thread, job);
+#endif /*_WIN32*/
+  }
+
+  for(i = 0; i != numjobs; ++i)
+  {
+    DeflateJob* job = &jobs[i];
+    if(!job->started) DeflateJob_run(job); /*also when a thread couldn't be created*/
+#ifdef _WIN32
+    else
+    {
+      WaitForSingleObject(job->thread, INFINITE);
+      CloseHandle(job->thread);
+    }
+#else /*_WIN32*/
+    else pthread_join(job->thread, NULL);
+#endif /*_WIN32*/
+  }
+
+  ucvector_init_buffer(&v, *out, *outsize);
+  for(i = 0; i != numjobs; ++i)
+  {
+    DeflateJob* job = &jobs[i];
+    if(!error) error = job->error;
+    if(!error)
+    {
+      size_t oldsize = v.size;
+      if(!ucvector_resize(&v, oldsize + job->out.size)) error = 83; /*alloc fail*/
+      else memcpy(&v.data[oldsize], job->out.data, job->out.size);
+      *adler = i == 0 ? job->adler : adler32_combine(*adler, job->adler, job->end - job->start);
+    }
+    lodepng_free(job->out.data);
+  }
+  lodepng_free(jobs);
+
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+#endif /*LODEPNG_COMPILE_THREADS*/
+
 unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
                                size_t insize, const LodePNGCompressSettings* settings)
 {
@@ -2159,6 +3296,7 @@ unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsig
   unsigned error;
   unsigned char* deflatedata = 0;
   size_t deflatesize = 0;
+  unsigned ADLER32 = 1;
 
   /*zlib data: 1 byte CMF (CM+CINFO), 1 byte FLG, deflate data, 4 byte ADLER32 checksum of the Decompressed data*/
   unsigned CMF = 120; /*0b01111000: CM 8, CINFO 7. With CINFO 7, any window size up to 32768 can be used.*/
@@ -2174,11 +3312,20 @@ unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsig
   ucvector_push_back(&outv, (unsigned char)(CMFFLG >> 8));
   ucvector_push_back(&outv, (unsigned char)(CMFFLG & 255));
 
-  error = deflate(&deflatedata, &deflatesize, in, insize, settings);
+#ifdef LODEPNG_COMPILE_THREADS
+  if(useParallelDeflate(insize, settings))
+  {
+    error = deflateParallel(&deflatedata, &deflatesize, &ADLER32, in, insize, settings);
+  }
+  else
+#endif /*LODEPNG_COMPILE_THREADS*/
+  {
+    error = deflate(&deflatedata, &deflatesize, in, insize, settings);
+    if(!error) ADLER32 = adler32(in, (unsigned)insize);
+  }
 
   if(!error)
   {
-    unsigned ADLER32 = adler32(in, (unsigned)insize);
     for(i = 0; i != deflatesize; ++i) ucvector_push_back(&outv, deflatedata[i]);
     lodepng_free(deflatedata);
     lodepng_add32bitInt(&outv, ADLER32);
@@ -2215,6 +3362,19 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsi
   if(!settings->custom_zlib) return 87; /*no custom zlib function provided */
   return settings->custom_zlib(out, outsize, in, insize, settings);
 }
+
+#ifdef LODEPNG_COMPILE_PNG
+/*only called without custom_zlib, there is no built-in zlib to fall back to*/
+static unsigned zlib_decompressv(ucvector* out, const unsigned char* in, size_t insize,
+                                 const LodePNGDecompressSettings* settings)
+{
+  (void)out;
+  (void)in;
+  (void)insize;
+  (void)settings;
+  return 87; /*no custom zlib function provided */
+}
+#endif /*LODEPNG_COMPILE_PNG*/
 #endif /*LODEPNG_COMPILE_DECODER*/
 #ifdef LODEPNG_COMPILE_ENCODER
 static unsigned zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
@@ -2243,13 +3403,47 @@ void lodepng_compress_settings_init(LodePNGCompressSettings* settings)
   settings->minmatch = 3;
   settings->nicematch = 128;
   settings->lazymatching = 1;
+  settings->maxchainlength = 0;
+  settings->hash4 = 0;
+  settings->numthreads = 0;
 
   settings->custom_zlib = 0;
   settings->custom_deflate = 0;
   settings->custom_context = 0;
 }
 
-const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0};
+const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0, 0, 0, 0};
+
+void lodepng_compress_settings_level(LodePNGCompressSettings* settings, unsigned level)
+{
+  /*windowsize, minmatch, nicematch, lazymatching and maxchainlength per level, tuned on
+  textures and frame captures. Lodepng doesn't weigh the cost of a match against that of its
+  literals, so matches of 3 make filtered scanlines bigger, not smaller: all levels use 4.*/
+  static const unsigned LEVELS[9][5] = {
+    {32768, 4, 16, 0, 4},
+    {32768, 4, 32, 0, 8},
+    {32768, 4, 64, 0, 16},
+    {32768, 4, 64, 1, 16},
+    {32768, 4, 128, 1, 32},
+    {32768, 4, 128, 1, 64},
+    {32768, 4, 258, 1, 128},
+    {32768, 4, 258, 1, 512},
+    {32768, 4, 258, 1, 4096}};
+  if(level == 0)
+  {
+    settings->btype = 0;
+    return;
+  }
+  if(level > 9) level = 9;
+  settings->btype = 2;
+  settings->use_lz77 = 1;
+  settings->windowsize = LEVELS[level - 1][0];
+  settings->minmatch = LEVELS[level - 1][1];
+  settings->nicematch = LEVELS[level - 1][2];
+  settings->lazymatching = LEVELS[level - 1][3];
+  settings->maxchainlength = LEVELS[level - 1][4];
+  settings->hash4 = 1;
+}
 
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -2283,52 +3477,334 @@ const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0,
 
 
 #ifndef LODEPNG_NO_COMPILE_CRC
-/* CRC polynomial: 0xedb88320 */
-static unsigned lodepng_crc32_table[256] = {
-           0u, 1996959894u, 3993919788u, 2567524794u,  124634137u, 1886057615u, 3915621685u, 2657392035u,
-   249268274u, 2044508324u, 3772115230u, 2547177864u,  162941995u, 2125561021u, 3887607047u, 2428444049u,
-   498536548u, 1789927666u, 4089016648u, 2227061214u,  450548861u, 1843258603u, 4107580753u, 2211677639u,
-   325883990u, 1684777152u, 4251122042u, 2321926636u,  335633487u, 1661365465u, 4195302755u, 2366115317u,
-   997073096u, 1281953886u, 3579855332u, 2724688242u, 1006888145u, 1258607687u, 3524101629u, 2768942443u,
-   901097722u, 1119000684u, 3686517206u, 2898065728u,  853044451u, 1172266101u, 3705015759u, 2882616665u,
-   651767980u, 1373503546u, 3369554304u, 3218104598u,  565507253u, 1454621731u, 3485111705u, 3099436303u,
-   671266974u, 1594198024u, 3322730930u, 2970347812u,  795835527u, 1483230225u, 3244367275u, 3060149565u,
-  1994146192u,   31158534u, 2563907772u, 4023717930u, 1907459465u,  112637215u, 2680153253u, 3904427059u,
-  2013776290u,  251722036u, 2517215374u, 3775830040u, 2137656763u,  141376813u, 2439277719u, 3865271297u,
-  1802195444u,  476864866u, 2238001368u, 4066508878u, 1812370925u,  453092731u, 2181625025u, 4111451223u,
-  1706088902u,  314042704u, 2344532202u, 4240017532u, 1658658271u,  366619977u, 2362670323u, 4224994405u,
-  1303535960u,  984961486u, 2747007092u, 3569037538u, 1256170817u, 1037604311u, 2765210733u, 3554079995u,
-  1131014506u,  879679996u, 2909243462u, 3663771856u, 1141124467u,  855842277u, 2852801631u, 3708648649u,
-  1342533948u,  654459306u, 3188396048u, 3373015174u, 1466479909u,  544179635u, 3110523913u, 3462522015u,
-  1591671054u,  702138776u, 2966460450u, 3352799412u, 1504918807u,  783551873u, 3082640443u, 3233442989u,
-  3988292384u, 2596254646u,   62317068u, 1957810842u, 3939845945u, 2647816111u,   81470997u, 1943803523u,
-  3814918930u, 2489596804u,  225274430u, 2053790376u, 3826175755u, 2466906013u,  167816743u, 2097651377u,
-  4027552580u, 2265490386u,  503444072u, 1762050814u, 4150417245u, 2154129355u,  426522225u, 1852507879u,
-  4275313526u, 2312317920u,  282753626u, 1742555852u, 4189708143u, 2394877945u,  397917763u, 1622183637u,
-  3604390888u, 2714866558u,  953729732u, 1340076626u, 3518719985u, 2797360999u, 1068828381u, 1219638859u,
-  3624741850u, 2936675148u,  906185462u, 1090812512u, 3747672003u, 2825379669u,  829329135u, 1181335161u,
-  3412177804u, 3160834842u,  628085408u, 1382605366u, 3423369109u, 3138078467u,  570562233u, 1426400815u,
-  3317316542u, 2998733608u,  733239954u, 1555261956u, 3268935591u, 3050360625u,  752459403u, 1541320221u,
-  2607071920u, 3965973030u, 1969922972u,   40735498u, 2617837225u, 3943577151u, 1913087877u,   83908371u,
-  2512341634u, 3803740692u, 2075208622u,  213261112u, 2463272603u, 3855990285u, 2094854071u,  198958881u,
-  2262029012u, 4057260610u, 1759359992u,  534414190u, 2176718541u, 4139329115u, 1873836001u,  414664567u,
-  2282248934u, 4279200368u, 1711684554u,  285281116u, 2405801727u, 4167216745u, 1634467795u,  376229701u,
-  2685067896u, 3608007406u, 1308918612u,  956543938u, 2808555105u, 3495958263u, 1231636301u, 1047427035u,
-  2932959818u, 3654703836u, 1088359270u,  936918000u, 2847714899u, 3736837829u, 1202900863u,  817233897u,
-  3183342108u, 3401237130u, 1404277552u,  615818150u, 3134207493u, 3453421203u, 1423857449u,  601450431u,
-  3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
+/*
+CRC polynomial: 0xedb88320
+lodepng_crc32_table[0] is the classic byte-at-a-time table. lodepng_crc32_table[k]
+gives the CRC contribution of a byte followed by k zero bytes, which lets
+lodepng_crc32 process 8 bytes per step ("slicing-by-8").
+*/
+static const unsigned lodepng_crc32_table[8][256] = {
+  {
+             0u, 1996959894u, 3993919788u, 2567524794u,  124634137u, 1886057615u, 3915621685u, 2657392035u,
+     249268274u, 2044508324u, 3772115230u, 2547177864u,  162941995u, 2125561021u, 3887607047u, 2428444049u,
+     498536548u, 1789927666u, 4089016648u, 2227061214u,  450548861u, 1843258603u, 4107580753u, 2211677639u,
+     325883990u, 1684777152u, 4251122042u, 2321926636u,  335633487u, 1661365465u, 4195302755u, 2366115317u,
+     997073096u, 1281953886u, 3579855332u, 2724688242u, 1006888145u, 1258607687u, 3524101629u, 2768942443u,
+     901097722u, 1119000684u, 3686517206u, 2898065728u,  853044451u, 1172266101u, 3705015759u, 2882616665u,
+     651767980u, 1373503546u, 3369554304u, 3218104598u,  565507253u, 1454621731u, 3485111705u, 3099436303u,
+     671266974u, 1594198024u, 3322730930u, 2970347812u,  795835527u, 1483230225u, 3244367275u, 3060149565u,
+    1994146192u,   31158534u, 2563907772u, 4023717930u, 1907459465u,  112637215u, 2680153253u, 3904427059u,
+    2013776290u,  251722036u, 2517215374u, 3775830040u, 2137656763u,  141376813u, 2439277719u, 3865271297u,
+    1802195444u,  476864866u, 2238001368u, 4066508878u, 1812370925u,  453092731u, 2181625025u, 4111451223u,
+    1706088902u,  314042704u, 2344532202u, 4240017532u, 1658658271u,  366619977u, 2362670323u, 4224994405u,
+    1303535960u,  984961486u, 2747007092u, 3569037538u, 1256170817u, 1037604311u, 2765210733u, 3554079995u,
+    1131014506u,  879679996u, 2909243462u, 3663771856u, 1141124467u,  855842277u, 2852801631u, 3708648649u,
+    1342533948u,  654459306u, 3188396048u, 3373015174u, 1466479909u,  544179635u, 3110523913u, 3462522015u,
+    1591671054u,  702138776u, 2966460450u, 3352799412u, 1504918807u,  783551873u, 3082640443u, 3233442989u,
+    3988292384u, 2596254646u,   62317068u, 1957810842u, 3939845945u, 2647816111u,   81470997u, 1943803523u,
+    3814918930u, 2489596804u,  225274430u, 2053790376u, 3826175755u, 2466906013u,  167816743u, 2097651377u,
+    4027552580u, 2265490386u,  503444072u, 1762050814u, 4150417245u, 2154129355u,  426522225u, 1852507879u,
+    4275313526u, 2312317920u,  282753626u, 1742555852u, 4189708143u, 2394877945u,  397917763u, 1622183637u,
+    3604390888u, 2714866558u,  953729732u, 1340076626u, 3518719985u, 2797360999u, 1068828381u, 1219638859u,
+    3624741850u, 2936675148u,  906185462u, 1090812512u, 3747672003u, 2825379669u,  829329135u, 1181335161u,
+    3412177804u, 3160834842u,  628085408u, 1382605366u, 3423369109u, 3138078467u,  570562233u, 1426400815u,
+    3317316542u, 2998733608u,  733239954u, 1555261956u, 3268935591u, 3050360625u,  752459403u, 1541320221u,
+    2607071920u, 3965973030u, 1969922972u,   40735498u, 2617837225u, 3943577151u, 1913087877u,   83908371u,
+    2512341634u, 3803740692u, 2075208622u,  213261112u, 2463272603u, 3855990285u, 2094854071u,  198958881u,
+    2262029012u, 4057260610u, 1759359992u,  534414190u, 2176718541u, 4139329115u, 1873836001u,  414664567u,
+    2282248934u, 4279200368u, 1711684554u,  285281116u, 2405801727u, 4167216745u, 1634467795u,  376229701u,
+    2685067896u, 3608007406u, 1308918612u,  956543938u, 2808555105u, 3495958263u, 1231636301u, 1047427035u,
+    2932959818u, 3654703836u, 1088359270u,  936918000u, 2847714899u, 3736837829u, 1202900863u,  817233897u,
+    3183342108u, 3401237130u, 1404277552u,  615818150u, 3134207493u, 3453421203u, 1423857449u,  601450431u,
+    3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
+  },
+  {
+             0u,  421212481u,  842424962u,  724390851u, 1684849924u, 2105013317u, 1448781702u, 1329698503u,
+    3369699848u, 3519200073u, 4210026634u, 3824474571u, 2897563404u, 3048111693u, 2659397006u, 2274893007u,
+    1254232657u, 1406739216u, 2029285587u, 1643069842u,  783210325u,  934667796u,  479770071u,   92505238u,
+    2182846553u, 2600511768u, 2955803355u, 2838940570u, 3866582365u, 4285295644u, 3561045983u, 3445231262u,
+    2508465314u, 2359236067u, 2813478432u, 3198777185u, 4058571174u, 3908292839u, 3286139684u, 3670389349u,
+    1566420650u, 1145479147u, 1869335592u, 1987116393u,  959540142u,  539646703u,  185010476u,  303839341u,
+    3745920755u, 3327985586u, 3983561841u, 4100678960u, 3140154359u, 2721170102u, 2300350837u, 2416418868u,
+     396344571u,  243568058u,  631889529u, 1018359608u, 1945336319u, 1793607870u, 1103436669u, 1490954812u,
+    4034481925u, 3915546180u, 3259968903u, 3679722694u, 2484439553u, 2366552896u, 2787371139u, 3208174018u,
+     950060301u,  565965900u,  177645455u,  328046286u, 1556873225u, 1171730760u, 1861902987u, 2011255754u,
+    3132841300u, 2745199637u, 2290958294u, 2442530455u, 3738671184u, 3352078609u, 3974232786u, 4126854035u,
+    1919080284u, 1803150877u, 1079293406u, 1498383519u,  370020952u,  253043481u,  607678682u, 1025720731u,
+    1711106983u, 2095471334u, 1472923941u, 1322268772u,   26324643u,  411738082u,  866634785u,  717028704u,
+    2904875439u, 3024081134u, 2668790573u, 2248782444u, 3376948395u, 3495106026u, 4219356713u, 3798300520u,
+     792689142u,  908347575u,  487136116u,   68299317u, 1263779058u, 1380486579u, 2036719216u, 1618931505u,
+    3890672638u, 4278043327u, 3587215740u, 3435896893u, 2206873338u, 2593195963u, 2981909624u, 2829542713u,
+     998479947u,  580430090u,  162921161u,  279890824u, 1609522511u, 1190423566u, 1842954189u, 1958874764u,
+    4082766403u, 3930137346u, 3245109441u, 3631694208u, 2536953671u, 2385372678u, 2768287173u, 3155920004u,
+    1900120602u, 1750776667u, 1131931800u, 1517083097u,  355290910u,  204897887u,  656092572u, 1040194781u,
+    3113746450u, 2692952403u, 2343461520u, 2461357009u, 3723805974u, 3304059991u, 4022511508u, 4141455061u,
+    2919742697u, 3072101800u, 2620513899u, 2234183466u, 3396041197u, 3547351212u, 4166851439u, 3779471918u,
+    1725839073u, 2143618976u, 1424512099u, 1307796770u,   45282277u,  464110244u,  813994343u,  698327078u,
+    3838160568u, 4259225593u, 3606301754u, 3488152955u, 2158586812u, 2578602749u, 2996767038u, 2877569151u,
+     740041904u,  889656817u,  506086962u,  120682355u, 1215357364u, 1366020341u, 2051441462u, 1667084919u,
+    3422213966u, 3538019855u, 4190942668u, 3772220557u, 2945847882u, 3062702859u, 2644537544u, 2226864521u,
+      52649286u,  439905287u,  823476164u,  672009861u, 1733269570u, 2119477507u, 1434057408u, 1281543041u,
+    2167981343u, 2552493150u, 3004082077u, 2853541596u, 3847487515u, 4233048410u, 3613549209u, 3464057816u,
+    1239502615u, 1358593622u, 2077699477u, 1657543892u,  764250643u,  882293586u,  532408465u,  111204816u,
+    1585378284u, 1197851309u, 1816695150u, 1968414767u,  974272232u,  587794345u,  136598634u,  289367339u,
+    2527558116u, 2411481253u, 2760973158u, 3179948583u, 4073438432u, 3956313505u, 3237863010u, 3655790371u,
+     347922877u,  229101820u,  646611775u, 1066513022u, 1892689081u, 1774917112u, 1122387515u, 1543337850u,
+    3697634229u, 3313392372u, 3998419255u, 4148705398u, 3087642289u, 2702352368u, 2319436851u, 2468674930u
+  },
+  {
+             0u,   29518391u,   59036782u,   38190681u,  118073564u,  114017003u,   76381362u,   89069189u,
+     236147128u,  265370511u,  228034006u,  206958561u,  152762724u,  148411219u,  178138378u,  190596925u,
+     472294256u,  501532999u,  530741022u,  509615401u,  456068012u,  451764635u,  413917122u,  426358261u,
+     305525448u,  334993663u,  296822438u,  275991697u,  356276756u,  352202787u,  381193850u,  393929805u,
+     944588512u,  965684439u, 1003065998u,  973863097u, 1061482044u, 1049003019u, 1019230802u, 1023561829u,
+     912136024u,  933002607u,  903529270u,  874031361u,  827834244u,  815125939u,  852716522u,  856752605u,
+     611050896u,  631869351u,  669987326u,  640506825u,  593644876u,  580921211u,  551983394u,  556069653u,
+     712553512u,  733666847u,  704405574u,  675154545u,  762387700u,  749958851u,  787859610u,  792175277u,
+    1889177024u, 1901651959u, 1931368878u, 1927033753u, 2006131996u, 1985040171u, 1947726194u, 1976933189u,
+    2122964088u, 2135668303u, 2098006038u, 2093965857u, 2038461604u, 2017599123u, 2047123658u, 2076625661u,
+    1824272048u, 1836991623u, 1866005214u, 1861914857u, 1807058540u, 1786244187u, 1748062722u, 1777547317u,
+    1655668488u, 1668093247u, 1630251878u, 1625932113u, 1705433044u, 1684323811u, 1713505210u, 1742760333u,
+    1222101792u, 1226154263u, 1263738702u, 1251046777u, 1339974652u, 1310460363u, 1281013650u, 1301863845u,
+    1187289752u, 1191637167u, 1161842422u, 1149379777u, 1103966788u, 1074747507u, 1112139306u, 1133218845u,
+    1425107024u, 1429406311u, 1467333694u, 1454888457u, 1408811148u, 1379576507u, 1350309090u, 1371438805u,
+    1524775400u, 1528845279u, 1499917702u, 1487177649u, 1575719220u, 1546255107u, 1584350554u, 1605185389u,
+    3778354048u, 3774312887u, 3803303918u, 3816007129u, 3862737756u, 3892238699u, 3854067506u, 3833203973u,
+    4012263992u, 4007927823u, 3970080342u, 3982554209u, 3895452388u, 3924658387u, 3953866378u, 3932773565u,
+    4245928176u, 4241609415u, 4271336606u, 4283762345u, 4196012076u, 4225268251u, 4187931714u, 4166823541u,
+    4076923208u, 4072833919u, 4035198246u, 4047918865u, 4094247316u, 4123732899u, 4153251322u, 4132437965u,
+    3648544096u, 3636082519u, 3673983246u, 3678331705u, 3732010428u, 3753090955u, 3723829714u, 3694611429u,
+    3614117080u, 3601426159u, 3572488374u, 3576541825u, 3496125444u, 3516976691u, 3555094634u, 3525581405u,
+    3311336976u, 3298595879u, 3336186494u, 3340255305u, 3260503756u, 3281337595u, 3251864226u, 3222399125u,
+    3410866088u, 3398419871u, 3368647622u, 3372945905u, 3427010420u, 3448139075u, 3485520666u, 3456284973u,
+    2444203584u, 2423127159u, 2452308526u, 2481530905u, 2527477404u, 2539934891u, 2502093554u, 2497740997u,
+    2679949304u, 2659102159u, 2620920726u, 2650438049u, 2562027300u, 2574714131u, 2603727690u, 2599670141u,
+    2374579504u, 2353749767u, 2383274334u, 2412743529u, 2323684844u, 2336421851u, 2298759554u, 2294686645u,
+    2207933576u, 2186809023u, 2149495014u, 2178734801u, 2224278612u, 2236720739u, 2266437690u, 2262135309u,
+    2850214048u, 2820717207u, 2858812622u, 2879680249u, 2934667388u, 2938704459u, 2909776914u, 2897069605u,
+    2817622296u, 2788420399u, 2759153014u, 2780249921u, 2700618180u, 2704950259u, 2742877610u, 2730399645u,
+    3049550800u, 3020298727u, 3057690558u, 3078802825u, 2999835404u, 3004150075u, 2974355298u, 2961925461u,
+    3151438440u, 3121956959u, 3092510214u, 3113327665u, 3168701108u, 3172786307u, 3210370778u, 3197646061u
+  },
+  {
+             0u, 3099354981u, 2852767883u,  313896942u, 2405603159u,  937357362u,  627793884u, 2648127673u,
+    3316918511u, 2097696650u, 1874714724u, 3607201537u, 1255587768u, 4067088605u, 3772741427u, 1482887254u,
+    1343838111u, 3903140090u, 4195393300u, 1118632049u, 3749429448u, 1741137837u, 1970407491u, 3452858150u,
+    2511175536u,  756094997u, 1067759611u, 2266550430u,  449832999u, 2725482306u, 2965774508u,  142231497u,
+    2687676222u,  412010587u,  171665333u, 2995192016u,  793786473u, 2548850444u, 2237264098u, 1038456711u,
+    1703315409u, 3711623348u, 3482275674u, 1999841343u, 3940814982u, 1381529571u, 1089329165u, 4166106984u,
+    4029413537u, 1217896388u, 1512189994u, 3802027855u, 2135519222u, 3354724499u, 3577784189u, 1845280792u,
+     899665998u, 2367928107u, 2677414085u,  657096608u, 3137160985u,   37822588u,  284462994u, 2823350519u,
+    2601801789u,  598228824u,  824021174u, 2309093331u,  343330666u, 2898962447u, 3195996129u,  113467524u,
+    1587572946u, 3860600759u, 4104763481u, 1276501820u, 3519211397u, 1769898208u, 2076913422u, 3279374443u,
+    3406630818u, 1941006535u, 1627703081u, 3652755532u, 1148164341u, 4241751952u, 3999682686u, 1457141531u,
+     247015245u, 3053797416u, 2763059142u,  470583459u, 2178658330u,  963106687u,  735213713u, 2473467892u,
+     992409347u, 2207944806u, 2435792776u,  697522413u, 3024379988u,  217581361u,  508405983u, 2800865210u,
+    4271038444u, 1177467017u, 1419450215u, 3962007554u, 1911572667u, 3377213406u, 3690561584u, 1665525589u,
+    1799331996u, 3548628985u, 3241568279u, 2039091058u, 3831314379u, 1558270126u, 1314193216u, 4142438437u,
+    2928380019u,  372764438u,   75645176u, 3158189981u,  568925988u, 2572515393u, 2346768303u,  861712586u,
+    3982079547u, 1441124702u, 1196457648u, 4293663189u, 1648042348u, 3666298377u, 3358779879u, 1888390786u,
+     686661332u, 2421291441u, 2196002399u,  978858298u, 2811169155u,  523464422u,  226935048u, 3040519789u,
+    3175145892u,  100435649u,  390670639u, 2952089162u,  841119475u, 2325614998u, 2553003640u,  546822429u,
+    2029308235u, 3225988654u, 3539796416u, 1782671013u, 4153826844u, 1328167289u, 1570739863u, 3844338162u,
+    1298864389u, 4124540512u, 3882013070u, 1608431339u, 3255406162u, 2058742071u, 1744848601u, 3501990332u,
+    2296328682u,  811816591u,  584513889u, 2590678532u,  129869501u, 3204563416u, 2914283062u,  352848211u,
+     494030490u, 2781751807u, 3078325777u,  264757620u, 2450577869u,  715964072u,  941166918u, 2158327331u,
+    3636881013u, 1618608400u, 1926213374u, 3396585883u, 1470427426u, 4011365959u, 4255988137u, 1158766284u,
+    1984818694u, 3471935843u, 3695453837u, 1693991400u, 4180638033u, 1100160564u, 1395044826u, 3952793279u,
+    3019491049u,  189112716u,  435162722u, 2706139399u, 1016811966u, 2217162459u, 2526189877u,  774831696u,
+     643086745u, 2666061564u, 2354934034u,  887166583u, 2838900430u,  294275499u,   54519365u, 3145957664u,
+    3823145334u, 1532818963u, 1240029693u, 4048895640u, 1820460577u, 3560857924u, 3331051178u, 2117577167u,
+    3598663992u, 1858283101u, 2088143283u, 3301633750u, 1495127663u, 3785470218u, 4078182116u, 1269332353u,
+     332098007u, 2876706482u, 3116540252u,   25085497u, 2628386432u,  605395429u,  916469259u, 2384220526u,
+    2254837415u, 1054503362u,  745528876u, 2496903497u,  151290352u, 2981684885u, 2735556987u,  464596510u,
+    1137851976u, 4218313005u, 3923506883u, 1365741990u, 3434129695u, 1946996346u, 1723425172u, 3724871409u
+  },
+  {
+             0u, 1029712304u, 2059424608u, 1201699536u, 4118849216u, 3370159984u, 2403399072u, 2988497936u,
+     812665793u,  219177585u, 1253054625u, 2010132753u, 3320900865u, 4170237105u, 3207642721u, 2186319825u,
+    1625331586u, 1568718386u,  438355170u,  658566482u, 2506109250u, 2818578674u, 4020265506u, 3535817618u,
+    1351670851u, 1844508147u,  709922595u,  389064339u, 2769320579u, 2557498163u, 3754961379u, 3803185235u,
+    3250663172u, 4238411444u, 3137436772u, 2254525908u,  876710340u,  153198708u, 1317132964u, 1944187668u,
+    4054934725u, 3436268917u, 2339452837u, 3054575125u,   70369797u,  961670069u, 2129760613u, 1133623509u,
+    2703341702u, 2621542710u, 3689016294u, 3867263574u, 1419845190u, 1774270454u,  778128678u,  318858390u,
+    2438067015u, 2888948471u, 3952189479u, 3606153623u, 1691440519u, 1504803895u,  504432359u,  594620247u,
+    1492342857u, 1704161785u,  573770537u,  525542041u, 2910060169u, 2417219385u, 3618876905u, 3939730521u,
+    1753420680u, 1440954936u,  306397416u,  790849880u, 2634265928u, 2690882808u, 3888375336u, 3668168600u,
+     940822475u,   91481723u, 1121164459u, 2142483739u, 3448989963u, 4042473659u, 3075684971u, 2318603227u,
+     140739594u,  889433530u, 1923340138u, 1338244826u, 4259521226u, 3229813626u, 2267247018u, 3124975642u,
+    2570221389u, 2756861693u, 3824297005u, 3734113693u, 1823658381u, 1372780605u,  376603373u,  722643805u,
+    2839690380u, 2485261628u, 3548540908u, 4007806556u, 1556257356u, 1638052860u,  637716780u,  459464860u,
+    4191346895u, 3300051327u, 2199040943u, 3195181599u,  206718479u,  825388991u, 1989285231u, 1274166495u,
+    3382881038u, 4106388158u, 3009607790u, 2382549470u, 1008864718u,   21111934u, 1189240494u, 2072147742u,
+    2984685714u, 2357631266u, 3408323570u, 4131834434u, 1147541074u, 2030452706u, 1051084082u,   63335554u,
+    2174155603u, 3170292451u, 4216760371u, 3325460867u, 1947622803u, 1232499747u,  248909555u,  867575619u,
+    3506841360u, 3966111392u, 2881909872u, 2527485376u,  612794832u,  434546784u, 1581699760u, 1663499008u,
+    3782634705u, 3692447073u, 2612412337u, 2799048193u,  351717905u,  697754529u, 1849071985u, 1398190273u,
+    1881644950u, 1296545318u,  182963446u,  931652934u, 2242328918u, 3100053734u, 4284967478u, 3255255942u,
+    1079497815u, 2100821479u,  983009079u,  133672583u, 3050795671u, 2293717799u, 3474399735u, 4067887175u,
+     281479188u,  765927844u, 1778867060u, 1466397380u, 3846680276u, 3626469220u, 2676489652u, 2733102084u,
+     548881365u,  500656741u, 1517752501u, 1729575173u, 3577210133u, 3898068133u, 2952246901u, 2459410373u,
+    3910527195u, 3564487019u, 2480257979u, 2931134987u,  479546907u,  569730987u, 1716854139u, 1530213579u,
+    3647316762u, 3825568426u, 2745561210u, 2663766474u,  753206746u,  293940330u, 1445287610u, 1799716618u,
+    2314567513u, 3029685993u, 4080348217u, 3461678473u, 2088098201u, 1091956777u,  112560889u, 1003856713u,
+    3112514712u, 2229607720u, 3276105720u, 4263857736u, 1275433560u, 1902492648u,  918929720u,  195422344u,
+     685033439u,  364179055u, 1377080511u, 1869921551u, 3713294623u, 3761522863u, 2811507327u, 2599689167u,
+     413436958u,  633644462u, 1650777982u, 1594160846u, 3978570462u, 3494118254u, 2548332990u, 2860797966u,
+    1211387997u, 1968470509u,  854852413u,  261368461u, 3182753437u, 2161434413u, 3346310653u, 4195650637u,
+    2017729436u, 1160000044u,   42223868u, 1071931724u, 2378480988u, 2963576044u, 4144295484u, 3395602316u
+  },
+  {
+             0u, 3411858341u, 1304994059u, 2257875630u, 2609988118u, 1355649459u, 3596215069u,  486879416u,
+    3964895853u,  655315400u, 2711298918u, 1791488195u, 2009251963u, 3164476382u,  973758832u, 4048990933u,
+      64357019u, 3364540734u, 1310630800u, 2235723829u, 2554806413u, 1394316072u, 3582976390u,  517157411u,
+    4018503926u,  618222419u, 2722963965u, 1762783832u, 1947517664u, 3209171269u,  970744811u, 4068520014u,
+     128714038u, 3438335635u, 1248109629u, 2167961496u, 2621261600u, 1466012805u, 3522553387u,  447296910u,
+    3959392091u,  547575038u, 2788632144u, 1835791861u, 1886307661u, 3140622056u, 1034314822u, 4143626211u,
+      75106221u, 3475428360u, 1236444838u, 2196665603u, 2682996155u, 1421317662u, 3525567664u,  427767573u,
+    3895035328u,  594892389u, 2782995659u, 1857943406u, 1941489622u, 3101955187u, 1047553757u, 4113347960u,
+     257428076u, 3288652233u, 1116777319u, 2311878850u, 2496219258u, 1603640287u, 3640781169u,  308099796u,
+    3809183745u,  676813732u, 2932025610u, 1704983215u, 2023410199u, 3016104370u,  894593820u, 4262377657u,
+     210634999u, 3352484690u, 1095150076u, 2316991065u, 2535410401u, 1547934020u, 3671583722u,  294336591u,
+    3772615322u,  729897279u, 2903845777u, 1716123700u, 2068629644u, 2953845545u,  914647431u, 4258839074u,
+     150212442u, 3282623743u, 1161604689u, 2388688372u, 2472889676u, 1480171241u, 3735940167u,  368132066u,
+    3836185911u,  805002898u, 2842635324u, 1647574937u, 2134298401u, 3026852996u,  855535146u, 4188192143u,
+     186781121u, 3229539940u, 1189784778u, 2377547631u, 2427670487u, 1542429810u, 3715886812u,  371670393u,
+    3882979244u,  741170185u, 2864262823u, 1642462466u, 2095107514u, 3082559007u,  824732849u, 4201955092u,
+     514856152u, 3589064573u, 1400419795u, 2552522358u, 2233554638u, 1316849003u, 3370776517u,   62202976u,
+    4075001525u,  968836368u, 3207280574u, 1954014235u, 1769133219u, 2720925446u,  616199592u, 4024870413u,
+     493229635u, 3594175974u, 1353627464u, 2616354029u, 2264355925u, 1303087088u, 3409966430u,    6498043u,
+    4046820398u,  979978123u, 3170710821u, 2007099008u, 1789187640u, 2717386141u,  661419827u, 3962610838u,
+     421269998u, 3527459403u, 1423225061u, 2676515648u, 2190300152u, 1238466653u, 3477467891u,   68755798u,
+    4115633027u, 1041448998u, 3095868040u, 1943789869u, 1860096405u, 2776760880u,  588673182u, 3897205563u,
+     449450869u, 3516317904u, 1459794558u, 2623431131u, 2170245475u, 1242006214u, 3432247400u,  131015629u,
+    4137259288u, 1036337853u, 3142660115u, 1879958454u, 1829294862u, 2790523051u,  549483013u, 3952910752u,
+     300424884u, 3669282065u, 1545650111u, 2541513754u, 2323209378u, 1092980487u, 3350330793u,  216870412u,
+    4256931033u,  921128828u, 2960342482u, 2066738807u, 1714085583u, 2910195050u,  736264132u, 3770592353u,
+     306060335u, 3647131530u, 1610005796u, 2494197377u, 2309971513u, 1123257756u, 3295149874u,  255536279u,
+    4268596802u,  892423655u, 3013951305u, 2029645036u, 1711070292u, 2929725425u,  674528607u, 3815288570u,
+     373562242u, 3709388839u, 1535949449u, 2429577516u, 2379569556u, 1183418929u, 3223189663u,  188820282u,
+    4195850735u,  827017802u, 3084859620u, 2089020225u, 1636228089u, 2866415708u,  743340786u, 3876759895u,
+     361896217u, 3738094268u, 1482340370u, 2466671543u, 2382584591u, 1163888810u, 3284924932u,  144124321u,
+    4190215028u,  849168593u, 3020503679u, 2136336858u, 1649465698u, 2836138695u,  798521449u, 3838094284u
+  },
+  {
+             0u, 2792819636u, 2543784233u,  837294749u, 4098827283u, 1379413927u, 1674589498u, 3316072078u,
+     871321191u, 2509784531u, 2758827854u,   34034938u, 3349178996u, 1641505216u, 1346337629u, 4131942633u,
+    1742642382u, 3249117050u, 4030828007u, 1446413907u, 2475800797u,  904311657u,   68069876u, 2725880384u,
+    1412551337u, 4064729373u, 3283010432u, 1708771380u, 2692675258u,  101317902u,  937551763u, 2442587175u,
+    3485284764u, 1774858792u, 1478633653u, 4266992385u, 1005723023u, 2642744891u, 2892827814u,  169477906u,
+    4233263099u, 1512406095u, 1808623314u, 3451546982u,  136139752u, 2926205020u, 2676114113u,  972376437u,
+    2825102674u,  236236518u, 1073525883u, 2576072655u, 1546420545u, 4200303349u, 3417542760u, 1841601500u,
+    2609703733u, 1039917185u,  202635804u, 2858742184u, 1875103526u, 3384067218u, 4166835727u, 1579931067u,
+    1141601657u, 3799809741u, 3549717584u, 1977839588u, 2957267306u,  372464350u,  668680259u, 2175552503u,
+    2011446046u, 3516084394u, 3766168119u, 1175200131u, 2209029901u,  635180217u,  338955812u, 2990736784u,
+     601221559u, 2242044419u, 3024812190u,  306049834u, 3617246628u, 1911408144u, 1074125965u, 3866285881u,
+     272279504u, 3058543716u, 2275784441u,  567459149u, 3832906691u, 1107462263u, 1944752874u, 3583875422u,
+    2343980261u,  767641425u,  472473036u, 3126744696u, 2147051766u, 3649987394u, 3899029983u, 1309766251u,
+    3092841090u,  506333494u,  801510315u, 2310084639u, 1276520081u, 3932237093u, 3683203000u, 2113813516u,
+    3966292011u, 1243601823u, 2079834370u, 3716205238u,  405271608u, 3192979340u, 2411259153u,  701492901u,
+    3750207052u, 2045810168u, 1209569125u, 4000285905u,  734575199u, 2378150379u, 3159862134u,  438345922u,
+    2283203314u,  778166598u,  529136603u, 3120492655u, 2086260449u, 3660498261u, 3955679176u, 1303499900u,
+    3153699989u,  495890209u,  744928700u, 2316418568u, 1337360518u, 3921775410u, 3626602927u, 2120129051u,
+    4022892092u, 1237286280u, 2018993941u, 3726666913u,  461853231u, 3186645403u, 2350400262u,  711936178u,
+    3693557851u, 2052076527u, 1270360434u, 3989775046u,  677911624u, 2384402428u, 3220639073u,  427820757u,
+    1202443118u, 3789347034u, 3493118535u, 1984154099u, 3018127229u,  362020041u,  612099668u, 2181885408u,
+    1950653705u, 3526596285u, 3822816288u, 1168934804u, 2148251930u,  645706414u,  395618355u, 2984485767u,
+     544559008u, 2248295444u, 3085590153u,  295523645u, 3560598451u, 1917673479u, 1134918298u, 3855773998u,
+     328860103u, 3052210803u, 2214924526u,  577903450u, 3889505748u, 1101147744u, 1883911421u, 3594338121u,
+    3424493451u, 1785369663u, 1535282850u, 4260726038u,  944946072u, 2653270060u, 2949491377u,  163225861u,
+    4294103532u, 1501944408u, 1752023237u, 3457862513u,  196998655u, 2915761739u, 2619532502u,  978710370u,
+    2881684293u,  229902577u, 1012666988u, 2586515928u, 1603020630u, 4193987810u, 3356702335u, 1852063179u,
+    2553040162u, 1046169238u,  263412747u, 2848217023u, 1818454321u, 3390333573u, 4227627032u, 1569420204u,
+      60859927u, 2782375331u, 2487203646u,  843627658u, 4159668740u, 1368951216u, 1617990445u, 3322386585u,
+     810543216u, 2520310724u, 2815490393u,   27783917u, 3288386659u, 1652017111u, 1402985802u, 4125677310u,
+    1685994201u, 3255382381u, 4091620336u, 1435902020u, 2419138250u,  910562686u,  128847843u, 2715354199u,
+    1469150398u, 4058414858u, 3222168983u, 1719234083u, 2749255853u,   94984985u,  876691844u, 2453031472u
+  },
+  {
+             0u, 3433693342u, 1109723005u, 2391738339u, 2219446010u, 1222643300u, 3329165703u,  180685081u,
+    3555007413u,  525277995u, 2445286600u, 1567235158u, 1471092047u, 2600801745u,  361370162u, 3642757804u,
+    2092642603u, 2953916853u, 1050555990u, 4063508168u, 4176560081u,  878395215u, 3134470316u, 1987983410u,
+    2942184094u, 1676945920u, 3984272867u,  567356797u,  722740324u, 3887998202u, 1764827929u, 2778407815u,
+    4185285206u,  903635656u, 3142804779u, 2012833205u, 2101111980u, 2979425330u, 1058630609u, 4088621903u,
+     714308067u, 3862526333u, 1756790430u, 2753330688u, 2933487385u, 1651734407u, 3975966820u,  542535930u,
+    2244825981u, 1231508451u, 3353891840u,  188896414u,   25648519u, 3442302233u, 1134713594u, 2399689316u,
+    1445480648u, 2592229462u,  336416693u, 3634843435u, 3529655858u,  516441772u, 2420588879u, 1559052753u,
+     698204909u, 3845636723u, 1807271312u, 2803025166u, 2916600855u, 1635634313u, 4025666410u,  593021940u,
+    4202223960u,  919787974u, 3093159461u, 1962401467u, 2117261218u, 2996361020u, 1008193759u, 4038971457u,
+    1428616134u, 2576151384u,  386135227u, 3685348389u, 3513580860u,  499580322u, 2471098945u, 1608776415u,
+    2260985971u, 1248454893u, 3303468814u,  139259792u,   42591881u, 3458459159u, 1085071860u, 2349261162u,
+    3505103035u,  474062885u, 2463016902u, 1583654744u, 1419882049u, 2550902495u,  377792828u, 3660491170u,
+      51297038u, 3483679632u, 1093385331u, 2374089965u, 2269427188u, 1273935210u, 3311514249u,  164344343u,
+    2890961296u, 1627033870u, 4000683757u,  585078387u,  672833386u, 3836780532u, 1782552599u, 2794821769u,
+    2142603813u, 3005188795u, 1032883544u, 4047146438u, 4227826911u,  928351297u, 3118105506u, 1970307900u,
+    1396409818u, 2677114180u,  287212199u, 3719594553u, 3614542624u,  467372990u, 2505346141u, 1509854403u,
+    2162073199u, 1282711281u, 3271268626u,  240228748u,   76845205u, 3359543307u, 1186043880u, 2317064054u,
+     796964081u, 3811226735u, 1839575948u, 2702160658u, 2882189835u, 1734392469u, 3924802934u,  625327592u,
+    4234522436u,  818917338u, 3191908409u, 1927981223u, 2016387518u, 3028656416u,  973776579u, 4137723485u,
+    2857232268u, 1726474002u, 3899187441u,  616751215u,  772270454u, 3803048424u, 1814228491u, 2693328533u,
+    2041117753u, 3036871847u,  999160644u, 4146592730u, 4259508931u,  826864221u, 3217552830u, 1936586016u,
+    3606501031u,  442291769u, 2496909786u, 1484378436u, 1388107869u, 2652297411u,  278519584u, 3694387134u,
+      85183762u, 3384397196u, 1194773103u, 2342308593u, 2170143720u, 1307820918u, 3279733909u,  265733131u,
+    2057717559u, 3054258089u,  948125770u, 4096344276u, 4276898253u,  843467091u, 3167309488u, 1885556270u,
+    2839764098u, 1709792284u, 3949353983u,  667704161u,  755585656u, 3785577190u, 1865176325u, 2743489947u,
+     102594076u, 3401021058u, 1144549729u, 2291298815u, 2186770662u, 1325234296u, 3228729243u,  215514885u,
+    3589828009u,  424832311u, 2547870420u, 1534552650u, 1370645331u, 2635621325u,  328688686u, 3745342640u,
+    2211456353u, 1333405183u, 3254067740u,  224338562u,  127544219u, 3408931589u, 1170156774u, 2299866232u,
+    1345666772u, 2627681866u,  303053225u, 3736746295u, 3565105198u,  416624816u, 2522494803u, 1525692365u,
+    4285207626u,  868291796u, 3176010551u, 1910772649u, 2065767088u, 3079346734u,  956571085u, 4121828691u,
+     747507711u, 3760459617u, 1856702594u, 2717976604u, 2831417605u, 1684930971u, 3940615800u,  642451174u
+  }
 };
 
+/*Continues the CRC crc of earlier bytes with data[0..length-1], the CRC of no bytes is 0.*/
+static unsigned update_crc32(unsigned crc, const unsigned char* data, size_t length)
+{
+  unsigned r = crc ^ 0xffffffffu;
+  while(length >= 8)
+  {
+    unsigned one = r ^ (data[0] | ((unsigned)data[1] << 8) | ((unsigned)data[2] << 16) | ((unsigned)data[3] << 24));
+    unsigned two = data[4] | ((unsigned)data[5] << 8) | ((unsigned)data[6] << 16) | ((unsigned)data[7] << 24);
+    r = lodepng_crc32_table[7][one & 0xff] ^ lodepng_crc32_table[6][(one >> 8) & 0xff]
+      ^ lodepng_crc32_table[5][(one >> 16) & 0xff] ^ lodepng_crc32_table[4][one >> 24]
+      ^ lodepng_crc32_table[3][two & 0xff] ^ lodepng_crc32_table[2][(two >> 8) & 0xff]
+      ^ lodepng_crc32_table[1][(two >> 16) & 0xff] ^ lodepng_crc32_table[0][two >> 24];
+    data += 8;
+    length -= 8;
+  }
+  while(length--)
+  {
+    r = lodepng_crc32_table[0][(r ^ *data++) & 0xff] ^ (r >> 8);
+  }
+  return r ^ 0xffffffffu;
+}
+
 /*Return the CRC of the bytes buf[0..len-1].*/
 unsigned lodepng_crc32(const unsigned char* data, size_t length)
 {
-  unsigned r = 0xffffffffu;
-  size_t i;
-  for(i = 0; i < length; ++i)
+  return update_crc32(0, data, length);
+}
+
+unsigned lodepng_crc32_selftest(void)
+{
+  unsigned i, k, bit;
+  for(i = 0; i != 256; ++i)
   {
-    r = lodepng_crc32_table[(r ^ data[i]) & 0xff] ^ (r >> 8);
+    unsigned c = i;
+    for(bit = 0; bit != 8; ++bit) c = (c & 1u) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+    if(lodepng_crc32_table[0][i] != c) return 0;
   }
-  return r ^ 0xffffffffu;
+  /*a byte followed by k zeros is the one followed by k - 1 zeros, advanced by one zero byte*/
+  for(k = 1; k != 8; ++k)
+  {
+    for(i = 0; i != 256; ++i)
+    {
+      unsigned prev = lodepng_crc32_table[k - 1][i];
+      if(lodepng_crc32_table[k][i] != ((prev >> 8) ^ lodepng_crc32_table[0][prev & 0xff])) return 0;
+    }
+  }
+  return 1;
 }
 #else /* !LODEPNG_NO_COMPILE_CRC */
 unsigned lodepng_crc32(const unsigned char* data, size_t length);
@@ -2952,82 +4428,67 @@ static void addColorBits(unsigned char* out, size_t index, unsigned bits, unsign
   else out[index * bits / 8] |= in;
 }
 
-typedef struct ColorTree ColorTree;
-
 /*
-One node of a color tree
-This is the data structure used to count the number of unique colors and to get a palette
-index for a color. It's like an octree, but because the alpha channel is used too, each
-node has 16 instead of 8 children.
+Hash table from RGBA colors to palette indices, used to count the unique colors
+of an image and to find the palette index of a color. It never holds more than
+257 colors (a full palette, plus one to know there are too many), so it's a flat
+array with open addressing and linear probing, without any allocation.
 */
-struct ColorTree
+#define COLOR_TABLE_SIZE 512 /*power of two, at least twice 257 so probe sequences stay short*/
+
+typedef struct ColorTable
 {
-  ColorTree* children[16]; /*up to 16 pointers to ColorTree of next level*/
-  int index; /*the payload. Only has a meaningful value if this is in the last level*/
-};
+  unsigned colors[COLOR_TABLE_SIZE]; /*packed as r << 24 | g << 16 | b << 8 | a*/
+  short index[COLOR_TABLE_SIZE]; /*the payload, -1 for an empty slot*/
+} ColorTable;
 
-static void color_tree_init(ColorTree* tree)
+static void color_table_init(ColorTable* table)
 {
-  int i;
-  for(i = 0; i != 16; ++i) tree->children[i] = 0;
-  tree->index = -1;
+  size_t i;
+  for(i = 0; i != COLOR_TABLE_SIZE; ++i) table->index[i] = -1;
 }
 
-static void color_tree_cleanup(ColorTree* tree)
+/*returns the slot of the color, or the empty slot where it would be added*/
+static size_t color_table_find(const ColorTable* table, unsigned color)
 {
-  int i;
-  for(i = 0; i != 16; ++i)
-  {
-    if(tree->children[i])
-    {
-      color_tree_cleanup(tree->children[i]);
-      lodepng_free(tree->children[i]);
-    }
-  }
+  /*multiplicative hash, the top bits of the product are the best mixed*/
+  size_t slot = ((color * 2654435761u) & 0xffffffffu) >> 23;
+  while(table->index[slot] >= 0 && table->colors[slot] != color) slot = (slot + 1) & (COLOR_TABLE_SIZE - 1);
+  return slot;
+}
+
+static unsigned color_table_pack(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+{
+  return ((unsigned)r << 24) | ((unsigned)g << 16) | ((unsigned)b << 8) | (unsigned)a;
 }
 
 /*returns -1 if color not present, its index otherwise*/
-static int color_tree_get(ColorTree* tree, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+static int color_table_get(const ColorTable* table, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
 {
-  int bit = 0;
-  for(bit = 0; bit < 8; ++bit)
-  {
-    int i = 8 * ((r >> bit) & 1) + 4 * ((g >> bit) & 1) + 2 * ((b >> bit) & 1) + 1 * ((a >> bit) & 1);
-    if(!tree->children[i]) return -1;
-    else tree = tree->children[i];
-  }
-  return tree ? tree->index : -1;
+  return table->index[color_table_find(table, color_table_pack(r, g, b, a))];
 }
 
 #ifdef LODEPNG_COMPILE_ENCODER
-static int color_tree_has(ColorTree* tree, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+static int color_table_has(const ColorTable* table, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
 {
-  return color_tree_get(tree, r, g, b, a) >= 0;
+  return color_table_get(table, r, g, b, a) >= 0;
 }
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
-/*color is not allowed to already exist.
-Index should be >= 0 (it's signed to be compatible with using -1 for "doesn't exist")*/
-static void color_tree_add(ColorTree* tree,
-                           unsigned char r, unsigned char g, unsigned char b, unsigned char a, unsigned index)
+/*Adds the color with the given index, or changes the index if the color is there
+already. At most 257 different colors may be added.*/
+static void color_table_add(ColorTable* table,
+                            unsigned char r, unsigned char g, unsigned char b, unsigned char a, unsigned index)
 {
-  int bit;
-  for(bit = 0; bit < 8; ++bit)
-  {
-    int i = 8 * ((r >> bit) & 1) + 4 * ((g >> bit) & 1) + 2 * ((b >> bit) & 1) + 1 * ((a >> bit) & 1);
-    if(!tree->children[i])
-    {
-      tree->children[i] = (ColorTree*)lodepng_malloc(sizeof(ColorTree));
-      color_tree_init(tree->children[i]);
-    }
-    tree = tree->children[i];
-  }
-  tree->index = (int)index;
+  unsigned color = color_table_pack(r, g, b, a);
+  size_t slot = color_table_find(table, color);
+  table->colors[slot] = color;
+  table->index[slot] = (short)index;
 }
 
 /*put a pixel, given its RGBA color, into image of any color type*/
 static unsigned rgba8ToPixel(unsigned char* out, size_t i,
-                             const LodePNGColorMode* mode, ColorTree* tree /*for palette*/,
+                             const LodePNGColorMode* mode, const ColorTable* table /*for palette*/,
                              unsigned char r, unsigned char g, unsigned char b, unsigned char a)
 {
   if(mode->colortype == LCT_GREY)
@@ -3059,7 +4520,7 @@ static unsigned rgba8ToPixel(unsigned char* out, size_t i,
   }
   else if(mode->colortype == LCT_PALETTE)
   {
-    int index = color_tree_get(tree, r, g, b, a);
+    int index = color_table_get(table, r, g, b, a);
     if(index < 0) return 82; /*color not in palette*/
     if(mode->bitdepth == 8) out[i] = index;
     else addColorBits(out, i, mode->bitdepth, (unsigned)index);
@@ -3383,27 +4844,156 @@ static void getPixelColorsRGBA8(unsigned char* buffer, size_t numpixels,
   }
 }
 
-/*Get RGBA16 color of pixel with index i (y * width + x) from the raw image with
-given color type, but the given color type must be 16-bit itself.*/
-static void getPixelColorRGBA16(unsigned short* r, unsigned short* g, unsigned short* b, unsigned short* a,
-                                const unsigned char* in, size_t i, const LodePNGColorMode* mode)
+#ifdef LODEPNG_COMPILE_CPU_DISPATCH
+/*RGB to RGBA with opaque alpha, 16 pixels per round. Returns the amount of pixels
+done, the caller converts the rest. The loads read 4 bytes past each 12, so it stops
+2 pixels before the end of the input.*/
+LODEPNG_TARGET_SSSE3
+static size_t convertRGB8ToRGBA8_ssse3(unsigned char* out, const unsigned char* in, size_t numpixels)
 {
-  if(mode->colortype == LCT_GREY)
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i alpha = _mm_set1_epi32((int)0xff000000u);
+  size_t i, k;
+  for(i = 0; i + 18 <= numpixels; i += 16)
   {
-    *r = *g = *b = 256 * in[i * 2 + 0] + in[i * 2 + 1];
-    if(mode->key_defined && 256U * in[i * 2 + 0] + in[i * 2 + 1] == mode->key_r) *a = 0;
-    else *a = 65535;
+    for(k = 0; k != 16; k += 4)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)&in[(i + k) * 3]);
+      v = _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alpha);
+      _mm_storeu_si128((__m128i*)&out[(i + k) * 4], v);
+    }
   }
-  else if(mode->colortype == LCT_RGB)
+  return i;
+}
+#endif /*LODEPNG_COMPILE_CPU_DISPATCH*/
+
+/*
+Fast paths of getPixelColorsRGBA8 for RGBA output from the most common input modes:
+8-bit greyscale, RGB, greyscale with alpha and palette, and 16-bit RGBA, vectorized
+where SSE2 (or SSSE3 for RGB) is there. A color key goes the generic way. cpu are the
+LODEPNG_CPU_ flags, looked up by the caller: lodepng_convert runs once per row when
+streaming. Returns 1 if the pixels were converted, 0 if getPixelColorsRGBA8 must do it.
+*/
+static unsigned getPixelColorsRGBA8Fast(unsigned char* out, size_t numpixels,
+                                        const unsigned char* in, const LodePNGColorMode* mode,
+                                        unsigned cpu)
+{
+  size_t i = 0;
+  (void)cpu; /*only used with LODEPNG_COMPILE_CPU_DISPATCH*/
+  if(mode->colortype == LCT_GREY && mode->bitdepth == 8 && !mode->key_defined)
   {
-    *r = 256u * in[i * 6 + 0] + in[i * 6 + 1];
-    *g = 256u * in[i * 6 + 2] + in[i * 6 + 3];
-    *b = 256u * in[i * 6 + 4] + in[i * 6 + 5];
-    if(mode->key_defined
-       && 256u * in[i * 6 + 0] + in[i * 6 + 1] == mode->key_r
-       && 256u * in[i * 6 + 2] + in[i * 6 + 3] == mode->key_g
-       && 256u * in[i * 6 + 4] + in[i * 6 + 5] == mode->key_b) *a = 0;
-    else *a = 65535;
+#ifdef LODEPNG_COMPILE_SSE2
+    const __m128i opaque = _mm_set1_epi8(-1);
+    for(; i + 16 <= numpixels; i += 16)
+    {
+      __m128i grey = _mm_loadu_si128((const __m128i*)&in[i]);
+      /*grey grey and grey alpha pairs, interleaved to grey grey grey alpha*/
+      __m128i gg = _mm_unpacklo_epi8(grey, grey);
+      __m128i ga = _mm_unpacklo_epi8(grey, opaque);
+      _mm_storeu_si128((__m128i*)&out[i * 4 + 0], _mm_unpacklo_epi16(gg, ga));
+      _mm_storeu_si128((__m128i*)&out[i * 4 + 16], _mm_unpackhi_epi16(gg, ga));
+      gg = _mm_unpackhi_epi8(grey, grey);
+      ga = _mm_unpackhi_epi8(grey, opaque);
+      _mm_storeu_si128((__m128i*)&out[i * 4 + 32], _mm_unpacklo_epi16(gg, ga));
+      _mm_storeu_si128((__m128i*)&out[i * 4 + 48], _mm_unpackhi_epi16(gg, ga));
+    }
+#endif /*LODEPNG_COMPILE_SSE2*/
+    for(; i != numpixels; ++i)
+    {
+      out[i * 4 + 0] = out[i * 4 + 1] = out[i * 4 + 2] = in[i];
+      out[i * 4 + 3] = 255;
+    }
+    return 1;
+  }
+  else if(mode->colortype == LCT_RGB && mode->bitdepth == 8 && !mode->key_defined)
+  {
+#ifdef LODEPNG_COMPILE_CPU_DISPATCH
+    if(numpixels >= 64 && (cpu & LODEPNG_CPU_SSSE3)) i = convertRGB8ToRGBA8_ssse3(out, in, numpixels);
+#endif /*LODEPNG_COMPILE_CPU_DISPATCH*/
+    for(; i != numpixels; ++i)
+    {
+      out[i * 4 + 0] = in[i * 3 + 0];
+      out[i * 4 + 1] = in[i * 3 + 1];
+      out[i * 4 + 2] = in[i * 3 + 2];
+      out[i * 4 + 3] = 255;
+    }
+    return 1;
+  }
+  else if(mode->colortype == LCT_GREY_ALPHA && mode->bitdepth == 8)
+  {
+#ifdef LODEPNG_COMPILE_SSE2
+    const __m128i low = _mm_set1_epi16(0x00ff);
+    for(; i + 8 <= numpixels; i += 8)
+    {
+      /*16-bit lanes of grey + 256 * alpha, the grey is doubled and interleaved with them*/
+      __m128i ga = _mm_loadu_si128((const __m128i*)&in[i * 2]);
+      __m128i grey = _mm_and_si128(ga, low);
+      __m128i gg = _mm_or_si128(grey, _mm_slli_epi16(grey, 8));
+      _mm_storeu_si128((__m128i*)&out[i * 4 + 0], _mm_unpacklo_epi16(gg, ga));
+      _mm_storeu_si128((__m128i*)&out[i * 4 + 16], _mm_unpackhi_epi16(gg, ga));
+    }
+#endif /*LODEPNG_COMPILE_SSE2*/
+    for(; i != numpixels; ++i)
+    {
+      out[i * 4 + 0] = out[i * 4 + 1] = out[i * 4 + 2] = in[i * 2 + 0];
+      out[i * 4 + 3] = in[i * 2 + 1];
+    }
+    return 1;
+  }
+  else if(mode->colortype == LCT_RGBA && mode->bitdepth == 16)
+  {
+#ifdef LODEPNG_COMPILE_SSE2
+    const __m128i low = _mm_set1_epi16(0x00ff);
+    for(; i + 4 <= numpixels; i += 4)
+    {
+      /*the values are big endian, the most significant byte is the low byte of the lanes*/
+      __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)&in[i * 8 + 0]), low);
+      __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)&in[i * 8 + 16]), low);
+      _mm_storeu_si128((__m128i*)&out[i * 4], _mm_packus_epi16(a, b));
+    }
+#endif /*LODEPNG_COMPILE_SSE2*/
+    for(i *= 4; i != numpixels * 4; ++i) out[i] = in[i * 2];
+    return 1;
+  }
+  else if(mode->colortype == LCT_PALETTE && mode->bitdepth == 8)
+  {
+    /*every index looked up in a full table, indices past the palette are black like
+    in getPixelColorsRGBA8*/
+    unsigned char table[256 * 4];
+    size_t palettesize = mode->palettesize < 256 ? mode->palettesize : 256;
+    if(palettesize) memcpy(table, mode->palette, palettesize * 4);
+    for(i = palettesize; i != 256; ++i)
+    {
+      table[i * 4 + 0] = table[i * 4 + 1] = table[i * 4 + 2] = 0;
+      table[i * 4 + 3] = 255;
+    }
+    for(i = 0; i != numpixels; ++i) memcpy(&out[i * 4], &table[in[i] * 4], 4);
+    return 1;
+  }
+  return 0;
+}
+
+/*Get RGBA16 color of pixel with index i (y * width + x) from the raw image with
+given color type, but the given color type must be 16-bit itself.*/
+static void getPixelColorRGBA16(unsigned short* r, unsigned short* g, unsigned short* b, unsigned short* a,
+                                const unsigned char* in, size_t i, const LodePNGColorMode* mode)
+{
+  if(mode->colortype == LCT_GREY)
+  {
+    *r = *g = *b = 256 * in[i * 2 + 0] + in[i * 2 + 1];
+    if(mode->key_defined && 256U * in[i * 2 + 0] + in[i * 2 + 1] == mode->key_r) *a = 0;
+    else *a = 65535;
+  }
+  else if(mode->colortype == LCT_RGB)
+  {
+    *r = 256u * in[i * 6 + 0] + in[i * 6 + 1];
+    *g = 256u * in[i * 6 + 2] + in[i * 6 + 3];
+    *b = 256u * in[i * 6 + 4] + in[i * 6 + 5];
+    if(mode->key_defined
+       && 256u * in[i * 6 + 0] + in[i * 6 + 1] == mode->key_r
+       && 256u * in[i * 6 + 2] + in[i * 6 + 3] == mode->key_g
+       && 256u * in[i * 6 + 4] + in[i * 6 + 5] == mode->key_b) *a = 0;
+    else *a = 65535;
   }
   else if(mode->colortype == LCT_GREY_ALPHA)
   {
@@ -3424,7 +5014,7 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
                          unsigned w, unsigned h)
 {
   size_t i;
-  ColorTree tree;
+  ColorTable table;
   size_t numpixels = w * h;
 
   if(lodepng_color_mode_equal(mode_out, mode_in))
@@ -3448,11 +5038,11 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
       palette = mode_in->palette;
     }
     if(palettesize < palsize) palsize = palettesize;
-    color_tree_init(&tree);
+    color_table_init(&table);
     for(i = 0; i != palsize; ++i)
     {
       const unsigned char* p = &palette[i * 4];
-      color_tree_add(&tree, p[0], p[1], p[2], p[3], i);
+      color_table_add(&table, p[0], p[1], p[2], p[3], (unsigned)i);
     }
   }
 
@@ -3467,7 +5057,12 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
   }
   else if(mode_out->bitdepth == 8 && mode_out->colortype == LCT_RGBA)
   {
-    getPixelColorsRGBA8(out, numpixels, 1, in, mode_in);
+#ifdef LODEPNG_COMPILE_CPU_DISPATCH
+    unsigned cpu = lodepng_cpu_features(); /*cached, no cpuid here*/
+#else /*LODEPNG_COMPILE_CPU_DISPATCH*/
+    unsigned cpu = 0;
+#endif /*LODEPNG_COMPILE_CPU_DISPATCH*/
+    if(!getPixelColorsRGBA8Fast(out, numpixels, in, mode_in, cpu)) getPixelColorsRGBA8(out, numpixels, 1, in, mode_in);
   }
   else if(mode_out->bitdepth == 8 && mode_out->colortype == LCT_RGB)
   {
@@ -3479,15 +5074,10 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
     for(i = 0; i != numpixels; ++i)
     {
       getPixelColorRGBA8(&r, &g, &b, &a, in, i, mode_in);
-      CERROR_TRY_RETURN(rgba8ToPixel(out, i, mode_out, &tree, r, g, b, a));
+      CERROR_TRY_RETURN(rgba8ToPixel(out, i, mode_out, &table, r, g, b, a));
     }
   }
 
-  if(mode_out->colortype == LCT_PALETTE)
-  {
-    color_tree_cleanup(&tree);
-  }
-
   return 0; /*no error*/
 }
 
@@ -3525,6 +5115,155 @@ static unsigned getValueRequiredBits(unsigned char value)
   return 8;
 }
 
+/*Returns 1 if any of the 16-bit values differs in its two bytes, so that the image
+really needs 16 bits. numbytes is the size of the image, all channels are checked.*/
+static unsigned hasSixteenBitValues(const unsigned char* in, size_t numbytes)
+{
+  size_t i = 0;
+#ifdef LODEPNG_COMPILE_SSE2
+  const __m128i low = _mm_set1_epi16(0x00ff);
+  for(; i + 16 <= numbytes; i += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)&in[i]);
+    __m128i same = _mm_cmpeq_epi16(_mm_and_si128(v, low), _mm_srli_epi16(v, 8));
+    if(_mm_movemask_epi8(same) != 0xffff) return 1;
+  }
+#endif /*LODEPNG_COMPILE_SSE2*/
+  for(; i + 1 < numbytes; i += 2)
+  {
+    if(in[i] != in[i + 1]) return 1;
+  }
+  return 0;
+}
+
+/*One step of the transparency detection of lodepng_get_color_profile for a pixel
+with 8-bit channels. Sets alpha_done once the profile needs a full alpha channel.*/
+static void colorProfileAlpha8(LodePNGColorProfile* profile, unsigned* alpha_done,
+                               unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+{
+  unsigned matchkey = (r == profile->key_r && g == profile->key_g && b == profile->key_b);
+  if(a != 255 && (a != 0 || (profile->key && !matchkey)))
+  {
+    profile->alpha = 1;
+    *alpha_done = 1;
+    if(profile->bits < 8) profile->bits = 8; /*PNG has no alphachannel modes with less than 8-bit per channel*/
+  }
+  else if(a == 0 && !profile->alpha && !profile->key)
+  {
+    profile->key = 1;
+    profile->key_r = r;
+    profile->key_g = g;
+    profile->key_b = b;
+  }
+  else if(a == 255 && profile->key && matchkey)
+  {
+    /* Color key cannot be used if an opaque pixel also has that RGB color. */
+    profile->alpha = 1;
+    *alpha_done = 1;
+    if(profile->bits < 8) profile->bits = 8; /*PNG has no alphachannel modes with less than 8-bit per channel*/
+  }
+}
+
+/*Counts the color in the profile if it wasn't seen yet. Returns whether counting is
+done, because maxnumcolors is reached.*/
+static unsigned colorProfileCount(LodePNGColorProfile* profile, ColorTable* table, unsigned maxnumcolors,
+                                  unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+{
+  if(!color_table_has(table, r, g, b, a))
+  {
+    color_table_add(table, r, g, b, a, profile->numcolors);
+    if(profile->numcolors < 256)
+    {
+      unsigned char* p = profile->palette;
+      unsigned n = profile->numcolors;
+      p[n * 4 + 0] = r;
+      p[n * 4 + 1] = g;
+      p[n * 4 + 2] = b;
+      p[n * 4 + 3] = a;
+    }
+    ++profile->numcolors;
+  }
+  return profile->numcolors >= maxnumcolors;
+}
+
+/*
+The pixel loop of lodepng_get_color_profile for 8-bit RGBA input, the most common
+input of the encoder. Per block of 16 pixels, SSE2 tells whether they're all grey
+and all opaque, so only the checks that the block can still change run per pixel.
+Runs of the same color skip the color table. Gives the same profile as the generic
+loop, which also ends once nothing can change anymore.
+*/
+static void colorProfileRGBA8(LodePNGColorProfile* profile, ColorTable* table,
+                              const unsigned char* in, size_t numpixels)
+{
+  unsigned colored_done = 0, alpha_done = 0, numcolors_done = 0;
+  size_t i = 0, j;
+
+  while(i != numpixels && !(colored_done && alpha_done && numcolors_done))
+  {
+    size_t end = numpixels - i < 16 ? numpixels : i + 16;
+    unsigned grey = 0, opaque = 0; /*whether all pixels of the block are known to be grey, opaque*/
+#ifdef LODEPNG_COMPILE_SSE2
+    if(end - i == 16)
+    {
+      const __m128i* p = (const __m128i*)&in[i * 4];
+      __m128i v0 = _mm_loadu_si128(p + 0), v1 = _mm_loadu_si128(p + 1);
+      __m128i v2 = _mm_loadu_si128(p + 2), v3 = _mm_loadu_si128(p + 3);
+      /*per pixel, byte 0 tells r == g and byte 1 g == b*/
+      int rgb = _mm_movemask_epi8(_mm_cmpeq_epi8(v0, _mm_srli_epi32(v0, 8)))
+              & _mm_movemask_epi8(_mm_cmpeq_epi8(v1, _mm_srli_epi32(v1, 8)))
+              & _mm_movemask_epi8(_mm_cmpeq_epi8(v2, _mm_srli_epi32(v2, 8)))
+              & _mm_movemask_epi8(_mm_cmpeq_epi8(v3, _mm_srli_epi32(v3, 8)));
+      __m128i all = _mm_and_si128(_mm_and_si128(v0, v1), _mm_and_si128(v2, v3));
+      grey = (rgb & 0x3333) == 0x3333;
+      opaque = (_mm_movemask_epi8(_mm_cmpeq_epi8(all, _mm_set1_epi8(-1))) & 0x8888) == 0x8888;
+    }
+#endif /*LODEPNG_COMPILE_SSE2*/
+
+    if(!colored_done && !grey)
+    {
+      for(j = i; j != end; ++j)
+      {
+        const unsigned char* c = &in[j * 4];
+        if(c[0] != c[1] || c[0] != c[2])
+        {
+          profile->colored = 1;
+          colored_done = 1;
+          if(profile->bits < 8) profile->bits = 8; /*PNG has no colored modes with less than 8-bit per channel*/
+          break;
+        }
+      }
+    }
+
+    /*only r is checked, < 8 bits is only relevant for greyscale. Once colored, the bits are 8
+    whatever came before, so the order doesn't matter.*/
+    for(j = i; j != end && profile->bits < 8; ++j)
+    {
+      unsigned bits = getValueRequiredBits(in[j * 4]);
+      if(bits > profile->bits) profile->bits = bits;
+    }
+
+    /*opaque pixels can only change something when there's a color key*/
+    if(!alpha_done && !(opaque && !profile->key))
+    {
+      for(j = i; j != end && !alpha_done; ++j)
+      {
+        const unsigned char* c = &in[j * 4];
+        colorProfileAlpha8(profile, &alpha_done, c[0], c[1], c[2], c[3]);
+      }
+    }
+
+    for(j = i; j != end && !numcolors_done; ++j)
+    {
+      const unsigned char* c = &in[j * 4];
+      if(j > 0 && c[0] == c[-4] && c[1] == c[-3] && c[2] == c[-2] && c[3] == c[-1]) continue;
+      numcolors_done = colorProfileCount(profile, table, 257, c[0], c[1], c[2], c[3]);
+    }
+
+    i = end;
+  }
+}
+
 /*profile must already have been inited with mode.
 It's ok to set some parameters of profile to done already.*/
 unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
@@ -3533,7 +5272,7 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
 {
   unsigned error = 0;
   size_t i;
-  ColorTree tree;
+  ColorTable table;
   size_t numpixels = w * h;
 
   unsigned colored_done = lodepng_is_greyscale_type(mode) ? 1 : 0;
@@ -3545,23 +5284,10 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
   unsigned sixteen = 0;
   if(bpp <= 8) maxnumcolors = bpp == 1 ? 2 : (bpp == 2 ? 4 : (bpp == 4 ? 16 : 256));
 
-  color_tree_init(&tree);
+  color_table_init(&table);
 
   /*Check if the 16-bit input is truly 16-bit*/
-  if(mode->bitdepth == 16)
-  {
-    unsigned short r, g, b, a;
-    for(i = 0; i != numpixels; ++i)
-    {
-      getPixelColorRGBA16(&r, &g, &b, &a, in, i, mode);
-      if((r & 255) != ((r >> 8) & 255) || (g & 255) != ((g >> 8) & 255) ||
-         (b & 255) != ((b >> 8) & 255) || (a & 255) != ((a >> 8) & 255)) /*first and second byte differ*/
-      {
-        sixteen = 1;
-        break;
-      }
-    }
-  }
+  if(mode->bitdepth == 16) sixteen = hasSixteenBitValues(in, lodepng_get_raw_size(w, h, mode));
 
   if(sixteen)
   {
@@ -3608,71 +5334,39 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
   }
   else /* < 16-bit */
   {
-    for(i = 0; i != numpixels; ++i)
+    if(mode->colortype == LCT_RGBA && mode->bitdepth == 8)
     {
-      unsigned char r = 0, g = 0, b = 0, a = 0;
-      getPixelColorRGBA8(&r, &g, &b, &a, in, i, mode);
-
-      if(!bits_done && profile->bits < 8)
-      {
-        /*only r is checked, < 8 bits is only relevant for greyscale*/
-        unsigned bits = getValueRequiredBits(r);
-        if(bits > profile->bits) profile->bits = bits;
-      }
-      bits_done = (profile->bits >= bpp);
-
-      if(!colored_done && (r != g || r != b))
+      colorProfileRGBA8(profile, &table, in, numpixels);
+    }
+    else
+    {
+      for(i = 0; i != numpixels; ++i)
       {
-        profile->colored = 1;
-        colored_done = 1;
-        if(profile->bits < 8) profile->bits = 8; /*PNG has no colored modes with less than 8-bit per channel*/
-      }
+        unsigned char r = 0, g = 0, b = 0, a = 0;
+        getPixelColorRGBA8(&r, &g, &b, &a, in, i, mode);
 
-      if(!alpha_done)
-      {
-        unsigned matchkey = (r == profile->key_r && g == profile->key_g && b == profile->key_b);
-        if(a != 255 && (a != 0 || (profile->key && !matchkey)))
-        {
-          profile->alpha = 1;
-          alpha_done = 1;
-          if(profile->bits < 8) profile->bits = 8; /*PNG has no alphachannel modes with less than 8-bit per channel*/
-        }
-        else if(a == 0 && !profile->alpha && !profile->key)
-        {
-          profile->key = 1;
-          profile->key_r = r;
-          profile->key_g = g;
-          profile->key_b = b;
-        }
-        else if(a == 255 && profile->key && matchkey)
+        if(!bits_done && profile->bits < 8)
         {
-          /* Color key cannot be used if an opaque pixel also has that RGB color. */
-          profile->alpha = 1;
-          alpha_done = 1;
-          if(profile->bits < 8) profile->bits = 8; /*PNG has no alphachannel modes with less than 8-bit per channel*/
+          /*only r is checked, < 8 bits is only relevant for greyscale*/
+          unsigned bits = getValueRequiredBits(r);
+          if(bits > profile->bits) profile->bits = bits;
         }
-      }
+        /*the bits never go past 8 here*/
+        bits_done = (profile->bits >= bpp || profile->bits >= 8);
 
-      if(!numcolors_done)
-      {
-        if(!color_tree_has(&tree, r, g, b, a))
+        if(!colored_done && (r != g || r != b))
         {
-          color_tree_add(&tree, r, g, b, a, profile->numcolors);
-          if(profile->numcolors < 256)
-          {
-            unsigned char* p = profile->palette;
-            unsigned n = profile->numcolors;
-            p[n * 4 + 0] = r;
-            p[n * 4 + 1] = g;
-            p[n * 4 + 2] = b;
-            p[n * 4 + 3] = a;
-          }
-          ++profile->numcolors;
-          numcolors_done = profile->numcolors >= maxnumcolors;
+          profile->colored = 1;
+          colored_done = 1;
+          if(profile->bits < 8) profile->bits = 8; /*PNG has no colored modes with less than 8-bit per channel*/
         }
-      }
 
-      if(alpha_done && numcolors_done && colored_done && bits_done) break;
+        if(!alpha_done) colorProfileAlpha8(profile, &alpha_done, r, g, b, a);
+
+        if(!numcolors_done) numcolors_done = colorProfileCount(profile, &table, maxnumcolors, r, g, b, a);
+
+        if(alpha_done && numcolors_done && colored_done && bits_done) break;
+      }
     }
 
     /*make the profile's key always 16-bit for consistency - repeat each byte twice*/
@@ -3681,7 +5375,6 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
     profile->key_b += (profile->key_b << 8);
   }
 
-  color_tree_cleanup(&tree);
   return error;
 }
 
@@ -3896,6 +5589,113 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h, LodePNGState* state,
   return state->error;
 }
 
+#ifdef LODEPNG_COMPILE_SSE2
+/*
+SSE2 versions of the Sub, Average and Paeth unfilters for scanlines with 3 or 4
+bytes per pixel (8-bit RGB and RGBA). These filters depend on the pixel to the
+left, so they work one pixel per iteration with all its channels in one register.
+Pixels are loaded and stored with exactly bytewidth bytes, because recon and
+scanline may be the same memory and the end of the scanline must not be overread.
+*/
+static __m128i unfilterLoadPixel(const unsigned char* p, size_t bytewidth)
+{
+  int value;
+  if(bytewidth == 4) memcpy(&value, p, 4);
+  else value = (int)(p[0] | ((unsigned)p[1] << 8) | ((unsigned)p[2] << 16));
+  return _mm_cvtsi32_si128(value);
+}
+
+static void unfilterStorePixel(unsigned char* p, __m128i pixel, size_t bytewidth)
+{
+  int value = _mm_cvtsi128_si32(pixel);
+  if(bytewidth == 4) memcpy(p, &value, 4);
+  else
+  {
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
+    p[2] = (unsigned char)(value >> 16);
+  }
+}
+
+static void unfilterSubSSE2(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length)
+{
+  __m128i a = _mm_setzero_si128();
+  size_t i;
+  for(i = 0; i < length; i += bytewidth)
+  {
+    a = _mm_add_epi8(a, unfilterLoadPixel(&scanline[i], bytewidth));
+    unfilterStorePixel(&recon[i], a, bytewidth);
+  }
+}
+
+static void unfilterUpSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                           size_t length)
+{
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16)
+  {
+    __m128i d = _mm_loadu_si128((const __m128i*)&scanline[i]);
+    __m128i b = _mm_loadu_si128((const __m128i*)&precon[i]);
+    _mm_storeu_si128((__m128i*)&recon[i], _mm_add_epi8(d, b));
+  }
+  for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+}
+
+static void unfilterAverageSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, size_t length)
+{
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128();
+  size_t i;
+  for(i = 0; i < length; i += bytewidth)
+  {
+    __m128i b = unfilterLoadPixel(&precon[i], bytewidth);
+    /*_mm_avg_epu8 rounds up, subtracting the lsb of a ^ b makes it the floor that PNG needs*/
+    __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    a = _mm_add_epi8(unfilterLoadPixel(&scanline[i], bytewidth), avg);
+    unfilterStorePixel(&recon[i], a, bytewidth);
+  }
+}
+
+static __m128i unfilterAbs16(__m128i x)
+{
+  return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static __m128i unfilterSelect(__m128i condition, __m128i t, __m128i e)
+{
+  return _mm_or_si128(_mm_and_si128(condition, t), _mm_andnot_si128(condition, e));
+}
+
+static void unfilterPaethSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                              size_t bytewidth, size_t length)
+{
+  /*the predictor needs a + b - c, so the channels are widened to 16 bits*/
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  size_t i;
+  for(i = 0; i < length; i += bytewidth)
+  {
+    __m128i b = _mm_unpacklo_epi8(unfilterLoadPixel(&precon[i], bytewidth), zero);
+    __m128i d = _mm_unpacklo_epi8(unfilterLoadPixel(&scanline[i], bytewidth), zero);
+    __m128i pa = _mm_sub_epi16(b, c); /*p - a, with p = a + b - c*/
+    __m128i pb = _mm_sub_epi16(a, c); /*p - b*/
+    __m128i pc = _mm_add_epi16(pa, pb); /*p - c*/
+    __m128i smallest;
+    pa = unfilterAbs16(pa);
+    pb = unfilterAbs16(pb);
+    pc = unfilterAbs16(pc);
+    smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    /*ties are broken in favor of a, then b, as in paethPredictor*/
+    a = unfilterSelect(_mm_cmpeq_epi16(smallest, pa), a, unfilterSelect(_mm_cmpeq_epi16(smallest, pb), b, c));
+    /*the byte wise add wraps in the low byte and leaves the zero high byte alone*/
+    a = _mm_add_epi8(a, d);
+    unfilterStorePixel(&recon[i], _mm_packus_epi16(a, a), bytewidth);
+    c = b;
+  }
+}
+#endif /*LODEPNG_COMPILE_SSE2*/
+
 static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
                                  size_t bytewidth, unsigned char filterType, size_t length)
 {
@@ -3909,10 +5709,35 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   */
 
   size_t i;
+#ifdef LODEPNG_COMPILE_SSE2
+  if(filterType == 2 && precon)
+  {
+    unfilterUpSSE2(recon, scanline, precon, length);
+    return 0;
+  }
+  if(bytewidth == 3 || bytewidth == 4)
+  {
+    if(filterType == 1)
+    {
+      unfilterSubSSE2(recon, scanline, bytewidth, length);
+      return 0;
+    }
+    if(filterType == 3 && precon)
+    {
+      unfilterAverageSSE2(recon, scanline, precon, bytewidth, length);
+      return 0;
+    }
+    if(filterType == 4 && precon)
+    {
+      unfilterPaethSSE2(recon, scanline, precon, bytewidth, length);
+      return 0;
+    }
+  }
+#endif /*LODEPNG_COMPILE_SSE2*/
   switch(filterType)
   {
     case 0:
-      for(i = 0; i != length; ++i) recon[i] = scanline[i];
+      if(recon != scanline) memmove(recon, scanline, length);
       break;
     case 1:
       for(i = 0; i != bytewidth; ++i) recon[i] = scanline[i];
@@ -4448,27 +6273,143 @@ static unsigned readChunk_pHYs(LodePNGInfo* info, const unsigned char* data, siz
 }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
-                          LodePNGState* state,
-                          const unsigned char* in, size_t insize)
+/*
+Reads one chunk after the header. IDAT data is appended to idat, IEND sets *IEND.
+unknown and critical_pos carry over from one chunk to the next. The caller must
+have checked that the whole chunk is inside the input. Return value is error.
+*/
+static unsigned readChunk(LodePNGState* state, ucvector* idat, const unsigned char* chunk,
+                          unsigned char* IEND, unsigned* unknown, unsigned* critical_pos)
+{
+  unsigned chunkLength = lodepng_chunk_length(chunk);
+  const unsigned char* data = lodepng_chunk_data_const(chunk); /*the data in the chunk*/
+
+  (void)critical_pos; /*only used for the ancillary chunks*/
+
+  /*IDAT chunk, containing compressed image data*/
+  if(lodepng_chunk_type_equals(chunk, "IDAT"))
+  {
+    size_t oldsize = idat->size;
+    if(!ucvector_resize(idat, oldsize + chunkLength)) return 83; /*alloc fail*/
+    if(chunkLength) memcpy(&idat->data[oldsize], data, chunkLength);
+    *critical_pos = 3;
+  }
+  /*IEND chunk*/
+  else if(lodepng_chunk_type_equals(chunk, "IEND"))
+  {
+    *IEND = 1;
+  }
+  /*palette chunk (PLTE)*/
+  else if(lodepng_chunk_type_equals(chunk, "PLTE"))
+  {
+    CERROR_TRY_RETURN(readChunk_PLTE(&state->info_png.color, data, chunkLength));
+    *critical_pos = 2;
+  }
+  /*palette transparency chunk (tRNS)*/
+  else if(lodepng_chunk_type_equals(chunk, "tRNS"))
+  {
+    CERROR_TRY_RETURN(readChunk_tRNS(&state->info_png.color, data, chunkLength));
+  }
+#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
+  /*background color chunk (bKGD)*/
+  else if(lodepng_chunk_type_equals(chunk, "bKGD"))
+  {
+    CERROR_TRY_RETURN(readChunk_bKGD(&state->info_png, data, chunkLength));
+  }
+  /*text chunk (tEXt)*/
+  else if(lodepng_chunk_type_equals(chunk, "tEXt"))
+  {
+    if(state->decoder.read_text_chunks)
+    {
+      CERROR_TRY_RETURN(readChunk_tEXt(&state->info_png, data, chunkLength));
+    }
+  }
+  /*compressed text chunk (zTXt)*/
+  else if(lodepng_chunk_type_equals(chunk, "zTXt"))
+  {
+    if(state->decoder.read_text_chunks)
+    {
+      CERROR_TRY_RETURN(readChunk_zTXt(&state->info_png, &state->decoder.zlibsettings, data, chunkLength));
+    }
+  }
+  /*international text chunk (iTXt)*/
+  else if(lodepng_chunk_type_equals(chunk, "iTXt"))
+  {
+    if(state->decoder.read_text_chunks)
+    {
+      CERROR_TRY_RETURN(readChunk_iTXt(&state->info_png, &state->decoder.zlibsettings, data, chunkLength));
+    }
+  }
+  else if(lodepng_chunk_type_equals(chunk, "tIME"))
+  {
+    CERROR_TRY_RETURN(readChunk_tIME(&state->info_png, data, chunkLength));
+  }
+  else if(lodepng_chunk_type_equals(chunk, "pHYs"))
+  {
+    CERROR_TRY_RETURN(readChunk_pHYs(&state->info_png, data, chunkLength));
+  }
+#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  else /*it's not an implemented chunk type, so ignore it: skip over the data*/
+  {
+    /*error: unknown critical chunk (5th bit of first byte of chunk type is 0)*/
+    if(!lodepng_chunk_ancillary(chunk)) return 69;
+
+    *unknown = 1;
+#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
+    if(state->decoder.remember_unknown_chunks)
+    {
+      CERROR_TRY_RETURN(lodepng_chunk_append(&state->info_png.unknown_chunks_data[*critical_pos - 1],
+                                             &state->info_png.unknown_chunks_size[*critical_pos - 1], chunk));
+    }
+#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  }
+
+  if(!state->decoder.ignore_crc && !*unknown) /*check CRC if wanted, only on known chunk types*/
+  {
+    if(lodepng_chunk_check_crc(chunk)) return 57; /*invalid CRC*/
+  }
+  return 0;
+}
+
+/*Size of the inflated IDAT data: all scanlines with their filter byte, of the 7 passes if interlaced.*/
+static size_t getScanlinesSize(unsigned w, unsigned h, const LodePNGInfo* info_png)
+{
+  const LodePNGColorMode* color = &info_png->color;
+  size_t size = 0;
+  if(info_png->interlace_method == 0)
+  {
+    /*The extra h is added because this are the filter bytes every scanline starts with*/
+    size = lodepng_get_raw_size_idat(w, h, color) + h;
+  }
+  else
+  {
+    /*Adam-7 interlaced: the size is the sum of the 7 sub-images sizes*/
+    size += lodepng_get_raw_size_idat((w + 7) >> 3, (h + 7) >> 3, color) + ((h + 7) >> 3);
+    if(w > 4) size += lodepng_get_raw_size_idat((w + 3) >> 3, (h + 7) >> 3, color) + ((h + 7) >> 3);
+    size += lodepng_get_raw_size_idat((w + 3) >> 2, (h + 3) >> 3, color) + ((h + 3) >> 3);
+    if(w > 2) size += lodepng_get_raw_size_idat((w + 1) >> 2, (h + 3) >> 2, color) + ((h + 3) >> 2);
+    size += lodepng_get_raw_size_idat((w + 1) >> 1, (h + 1) >> 2, color) + ((h + 1) >> 2);
+    if(w > 1) size += lodepng_get_raw_size_idat((w + 0) >> 1, (h + 1) >> 1, color) + ((h + 1) >> 1);
+    size += lodepng_get_raw_size_idat((w + 0), (h + 0) >> 1, color) + ((h + 0) >> 1);
+  }
+  return size;
+}
+
+/*
+Reads all chunks, and puts the concatenated data of the IDAT chunks in idat, which
+must be initialized by the caller.
+*/
+static void decodeChunks(ucvector* idat, unsigned* w, unsigned* h,
+                         LodePNGState* state,
+                         const unsigned char* in, size_t insize)
 {
   unsigned char IEND = 0;
   const unsigned char* chunk;
-  size_t i;
-  ucvector idat; /*the data from idat chunks*/
-  ucvector scanlines;
-  size_t predict;
   size_t numpixels;
 
   /*for unknown chunk order*/
   unsigned unknown = 0;
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned critical_pos = 1; /*1 = after IHDR, 2 = after PLTE, 3 = after IDAT*/
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-
-  /*provide some proper output values if error will happen*/
-  *out = 0;
 
   state->error = lodepng_inspect(w, h, state, in, insize); /*reads header and resets other parameters in state->info_png*/
   if(state->error) return;
@@ -4481,7 +6422,6 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   bytes with 16-bit RGBA, the rest is room for filter bytes.*/
   if(numpixels > 268435455) CERROR_RETURN(state->error, 92);
 
-  ucvector_init(&idat);
   chunk = &in[33]; /*first byte of the first chunk after the header*/
 
   /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk.
@@ -4489,7 +6429,6 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   while(!IEND && !state->error)
   {
     unsigned chunkLength;
-    const unsigned char* data; /*the data in the chunk*/
 
     /*error: size of the in buffer too small to contain next chunk*/
     if((size_t)((chunk - in) + 12) > insize || chunk < in) CERROR_BREAK(state->error, 30);
@@ -4499,198 +6438,689 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     /*error: chunk length larger than the max PNG chunk size*/
     if(chunkLength > 2147483647) CERROR_BREAK(state->error, 63);
 
-    if((size_t)((chunk - in) + chunkLength + 12) > insize || (chunk + chunkLength + 12) < in)
-    {
-      CERROR_BREAK(state->error, 64); /*error: size of the in buffer too small to contain next chunk*/
-    }
+    if((size_t)((chunk - in) + chunkLength + 12) > insize || (chunk + chunkLength + 12) < in)
+    {
+      CERROR_BREAK(state->error, 64); /*error: size of the in buffer too small to contain next chunk*/
+    }
+
+    state->error = readChunk(state, idat, chunk, &IEND, &unknown, &critical_pos);
+
+    if(!IEND) chunk = lodepng_chunk_next_const(chunk);
+  }
+}
+
+/*
+Inflates the IDAT data into scanlines, which is then still filtered (and split in
+the Adam7 passes if interlaced). scanlines must be initialized by the caller, it's
+the scratch buffer the image is unfiltered in. Return value is error.
+*/
+static unsigned inflateScanlines(ucvector* scanlines, const ucvector* idat, unsigned w, unsigned h,
+                                 const LodePNGState* state)
+{
+  unsigned error;
+  const LodePNGDecompressSettings* zlibsettings = &state->decoder.zlibsettings;
+  /*custom decompressors allocate on their own, the arena can only be used with the built-in one*/
+  unsigned custom = zlibsettings->custom_zlib || zlibsettings->custom_inflate;
+  /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation.
+  If the decompressed size does not match the prediction, the image must be corrupt.*/
+  size_t predict = getScanlinesSize(w, h, &state->info_png);
+
+  if(custom) scanlines->arena = 0;
+  if(!ucvector_reserve(scanlines, predict)) return 83; /*alloc fail*/
+  if(custom) error = zlib_decompress(&scanlines->data, &scanlines->size, idat->data, idat->size, zlibsettings);
+  else error = zlib_decompressv(scanlines, idat->data, idat->size, zlibsettings);
+  if(!error && scanlines->size != predict) error = 91; /*decompressed size doesn't match prediction*/
+  return error;
+}
+
+/*
+Checks which color mode the decoded image is returned in and stores the size in
+bytes it needs in outsize. After this, state->info_raw describes the output, also
+when color_convert is disabled. Return value is error.
+*/
+static unsigned getDecodedSize(size_t* outsize, unsigned w, unsigned h, LodePNGState* state)
+{
+  if(!state->decoder.color_convert)
+  {
+    /*store the info_png color settings on the info_raw so that the info_raw still reflects what colortype
+    the raw image has to the end user*/
+    CERROR_TRY_RETURN(lodepng_color_mode_copy(&state->info_raw, &state->info_png.color));
+  }
+  else if(!lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
+  {
+    /*TODO: check if this works according to the statement in the documentation: "The converter can convert
+    from greyscale input color type, to 8-bit greyscale or greyscale with alpha"*/
+    if(!(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
+       && !(state->info_raw.bitdepth == 8))
+    {
+      return 56; /*unsupported color mode conversion*/
+    }
+  }
+  *outsize = lodepng_get_raw_size(w, h, &state->info_raw);
+  return 0;
+}
+
+/*
+Unfilters the scanlines produced by decodeScanlines and writes the image to out,
+converted to state->info_raw if that differs from the PNG's color mode. out must
+have room for the size given by getDecodedSize. Without conversion the image is
+unfiltered straight into out, with conversion a non-interlaced image is unfiltered
+in place in scanlines and converted from there, so no extra image buffer is needed.
+*/
+static unsigned postProcessInto(unsigned char* out, ucvector* scanlines, unsigned w, unsigned h,
+                                const LodePNGState* state)
+{
+  unsigned error = 0;
+  const LodePNGColorMode* mode_png = &state->info_png.color;
+  if(lodepng_color_mode_equal(&state->info_raw, mode_png))
+  {
+    /*postProcessScanlines needs a zeroed output to set sub-byte pixels in*/
+    if(lodepng_get_bpp(mode_png) < 8) memset(out, 0, lodepng_get_raw_size(w, h, mode_png));
+    return postProcessScanlines(out, scanlines->data, w, h, &state->info_png);
+  }
+  if(state->info_png.interlace_method == 0)
+  {
+    /*unfilter and removePaddingBits both support working in place*/
+    error = postProcessScanlines(scanlines->data, scanlines->data, w, h, &state->info_png);
+    if(!error) error = lodepng_convert(out, scanlines->data, &state->info_raw, mode_png, w, h);
+  }
+  else
+  {
+    /*Adam7_deinterlace scatters the passes, that needs a separate buffer*/
+    size_t rawsize = lodepng_get_raw_size(w, h, mode_png);
+    unsigned char* raw = (unsigned char*)arena_malloc(state->arena, rawsize);
+    if(!raw) return 83; /*alloc fail*/
+    memset(raw, 0, rawsize);
+    error = postProcessScanlines(raw, scanlines->data, w, h, &state->info_png);
+    if(!error) error = lodepng_convert(out, raw, &state->info_raw, mode_png, w, h);
+    arena_free(state->arena, raw);
+  }
+  return error;
+}
+
+#if defined(LODEPNG_COMPILE_THREADS) && defined(LODEPNG_COMPILE_ZLIB)
+/*
+The pipelined decoder: a second thread inflates the IDAT data block by block into
+the scanlines buffer, while the calling thread unfilters and converts the rows as
+soon as they're complete. The inflate thread only writes past the completed part
+and the calling thread only touches the completed part, so only the size of that
+part needs the lock. The inflate thread allocates with lodepng_malloc, never from
+the arena, so the arena is still only used by one thread.
+*/
+
+/*images with less filtered data than this aren't worth starting a thread for*/
+#define PIPELINE_MIN_SIZE 262144
+
+typedef struct Pipeline
+{
+  const unsigned char* in; /*the zlib data*/
+  size_t insize;
+  const LodePNGDecompressSettings* settings;
+  unsigned char* scanlines; /*the filtered image, filled in by the inflate thread*/
+  size_t predict; /*size of scanlines*/
+  /*the fields below are guarded by the lock*/
+  size_t ready; /*amount of bytes at the start of scanlines that are complete*/
+  unsigned done; /*whether the inflate thread finished*/
+  unsigned error; /*error of the inflate thread*/
+#ifdef _WIN32
+  CRITICAL_SECTION lock;
+  CONDITION_VARIABLE cond;
+#else /*_WIN32*/
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#endif /*_WIN32*/
+} Pipeline;
+
+static void Pipeline_lock(Pipeline* p)
+{
+#ifdef _WIN32
+  EnterCriticalSection(&p->lock);
+#else /*_WIN32*/
+  pthread_mutex_lock(&p->lock);
+#endif /*_WIN32*/
+}
+
+static void Pipeline_unlock(Pipeline* p)
+{
+#ifdef _WIN32
+  LeaveCriticalSection(&p->lock);
+#else /*_WIN32*/
+  pthread_mutex_unlock(&p->lock);
+#endif /*_WIN32*/
+}
+
+/*waits for a signal of the other thread, must be called with the lock held*/
+static void Pipeline_wait(Pipeline* p)
+{
+#ifdef _WIN32
+  SleepConditionVariableCS(&p->cond, &p->lock, INFINITE);
+#else /*_WIN32*/
+  pthread_cond_wait(&p->cond, &p->lock);
+#endif /*_WIN32*/
+}
+
+/*publishes the progress of the inflate thread to the calling thread*/
+static void Pipeline_publish(Pipeline* p, size_t ready, unsigned done, unsigned error)
+{
+  Pipeline_lock(p);
+  p->ready = ready;
+  p->done = done;
+  p->error = error;
+#ifdef _WIN32
+  WakeConditionVariable(&p->cond);
+#else /*_WIN32*/
+  pthread_cond_signal(&p->cond);
+#endif /*_WIN32*/
+  Pipeline_unlock(p);
+}
+
+/*
+The inflate thread. Same as zlib_decompressv, but after each deflate block its output
+is copied to the scanlines and published, only the last 32K stay in the window as
+the history for the next block. Errors are reported in the same order as by
+zlib_decompressv followed by the size check of inflateScanlines.
+*/
+static void Pipeline_inflate(Pipeline* p)
+{
+  ucvector window; /*decoded data: the last 32K of the previous blocks, then the current block*/
+  LodePNGBitReader reader;
+  size_t pos = 0; /*byte position in the window*/
+  size_t total = 0; /*amount of bytes decoded, can be more than predict if the image is corrupt*/
+  unsigned BFINAL = 0, error = 0;
+  unsigned adler = 1;
+
+  ucvector_init(&window);
+  if(p->insize < 2) error = 53; /*error, size of zlib data too small*/
+  else error = readZlibHeader(p->in);
+  if(!error) LodePNGBitReader_init(&reader, p->in + 2, p->insize - 2);
+
+  while(!error && !BFINAL)
+  {
+    unsigned BTYPE;
+    size_t start = pos, length;
+    if(reader.bp + 2 >= reader.bitsize) ERROR_BREAK(52); /*error, bit pointer will jump past memory*/
+    BFINAL = readBits(&reader, 1);
+    BTYPE = readBits(&reader, 2);
+
+    if(BTYPE == 3) error = 20; /*error: invalid BTYPE*/
+    else if(BTYPE == 0) error = inflateNoCompression(&window, &reader, &pos); /*no compression*/
+    else error = inflateHuffmanBlock(&window, &reader, &pos, BTYPE); /*compression, BTYPE 01 or 10*/
+    if(error) break;
+
+    length = pos - start;
+    if(!p->settings->ignore_adler32) adler = update_adler32(adler, &window.data[start], (unsigned)length);
+    /*the image is corrupt if there's more, but the adler32 check decides which error is given*/
+    if(total < p->predict) memcpy(&p->scanlines[total], &window.data[start], length < p->predict - total ? length : p->predict - total);
+    total += length;
+
+    if(pos > 65536)
+    {
+      memmove(window.data, &window.data[pos - 32768], 32768);
+      pos = 32768;
+    }
+    if(!BFINAL) Pipeline_publish(p, total < p->predict ? total : p->predict, 0, 0);
+  }
+
+  if(!error && !p->settings->ignore_adler32)
+  {
+    if(lodepng_read32bitInt(&p->in[p->insize - 4]) != adler) error = 58; /*error, adler checksum not correct*/
+  }
+  if(!error && total != p->predict) error = 91; /*decompressed size doesn't match prediction*/
+  ucvector_cleanup(&window);
+  Pipeline_publish(p, total < p->predict ? total : p->predict, 1, error);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI Pipeline_thread(LPVOID p)
+{
+  Pipeline_inflate((Pipeline*)p);
+  return 0;
+}
+#else /*_WIN32*/
+static void* Pipeline_thread(void* p)
+{
+  Pipeline_inflate((Pipeline*)p);
+  return 0;
+}
+#endif /*_WIN32*/
+
+/*
+The calling thread's part: unfilters every row once it's complete, in place in the
+scanlines if the rows must be converted after, or else straight into out. Stops at
+the first error, the inflate thread is left to finish. Return value is error.
+*/
+static unsigned Pipeline_unfilter(Pipeline* p, unsigned char* out, unsigned w, unsigned h,
+                                  const LodePNGState* state)
+{
+  const LodePNGColorMode* mode_png = &state->info_png.color;
+  unsigned bpp = lodepng_get_bpp(mode_png);
+  size_t bytewidth = (bpp + 7) / 8;
+  size_t linebytes = ((size_t)w * bpp + 7) / 8;
+  unsigned convert = !lodepng_color_mode_equal(&state->info_raw, mode_png);
+  size_t outlinebytes = lodepng_get_raw_size(w, 1, &state->info_raw);
+  /*the rows have no padding bits (see usePipeline), so unfiltered rows are the raw image*/
+  unsigned char* raw = convert ? p->scanlines : out;
+  unsigned y = 0, error = 0;
+
+  while(y < h && !error)
+  {
+    unsigned y0 = y, y1;
+    size_t ready;
 
-    data = lodepng_chunk_data_const(chunk);
+    Pipeline_lock(p);
+    while(!p->done && p->ready < (y + 1) * (linebytes + 1)) Pipeline_wait(p);
+    ready = p->ready;
+    Pipeline_unlock(p);
 
-    /*IDAT chunk, containing compressed image data*/
-    if(lodepng_chunk_type_equals(chunk, "IDAT"))
-    {
-      size_t oldsize = idat.size;
-      if(!ucvector_resize(&idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
-      for(i = 0; i != chunkLength; ++i) idat.data[oldsize + i] = data[i];
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-      critical_pos = 3;
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-    }
-    /*IEND chunk*/
-    else if(lodepng_chunk_type_equals(chunk, "IEND"))
-    {
-      IEND = 1;
-    }
-    /*palette chunk (PLTE)*/
-    else if(lodepng_chunk_type_equals(chunk, "PLTE"))
-    {
-      state->error = readChunk_PLTE(&state->info_png.color, data, chunkLength);
-      if(state->error) break;
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-      critical_pos = 2;
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-    }
-    /*palette transparency chunk (tRNS)*/
-    else if(lodepng_chunk_type_equals(chunk, "tRNS"))
-    {
-      state->error = readChunk_tRNS(&state->info_png.color, data, chunkLength);
-      if(state->error) break;
-    }
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-    /*background color chunk (bKGD)*/
-    else if(lodepng_chunk_type_equals(chunk, "bKGD"))
-    {
-      state->error = readChunk_bKGD(&state->info_png, data, chunkLength);
-      if(state->error) break;
-    }
-    /*text chunk (tEXt)*/
-    else if(lodepng_chunk_type_equals(chunk, "tEXt"))
-    {
-      if(state->decoder.read_text_chunks)
-      {
-        state->error = readChunk_tEXt(&state->info_png, data, chunkLength);
-        if(state->error) break;
-      }
-    }
-    /*compressed text chunk (zTXt)*/
-    else if(lodepng_chunk_type_equals(chunk, "zTXt"))
-    {
-      if(state->decoder.read_text_chunks)
-      {
-        state->error = readChunk_zTXt(&state->info_png, &state->decoder.zlibsettings, data, chunkLength);
-        if(state->error) break;
-      }
-    }
-    /*international text chunk (iTXt)*/
-    else if(lodepng_chunk_type_equals(chunk, "iTXt"))
-    {
-      if(state->decoder.read_text_chunks)
-      {
-        state->error = readChunk_iTXt(&state->info_png, &state->decoder.zlibsettings, data, chunkLength);
-        if(state->error) break;
-      }
-    }
-    else if(lodepng_chunk_type_equals(chunk, "tIME"))
+    y1 = ready / (linebytes + 1) < h ? (unsigned)(ready / (linebytes + 1)) : h;
+    if(y1 == y0) break; /*the inflate thread stopped, it gives the error*/
+
+    for(y = y0; y < y1 && !error; ++y)
     {
-      state->error = readChunk_tIME(&state->info_png, data, chunkLength);
-      if(state->error) break;
+      const unsigned char* line = &p->scanlines[y * (linebytes + 1)];
+      const unsigned char* prevline = y ? &raw[(y - 1) * linebytes] : 0;
+      error = unfilterScanline(&raw[y * linebytes], &line[1], prevline, bytewidth, line[0], linebytes);
     }
-    else if(lodepng_chunk_type_equals(chunk, "pHYs"))
+    if(!error && convert)
     {
-      state->error = readChunk_pHYs(&state->info_png, data, chunkLength);
-      if(state->error) break;
+      error = lodepng_convert(&out[y0 * outlinebytes], &raw[y0 * linebytes], &state->info_raw, mode_png, w, y1 - y0);
     }
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-    else /*it's not an implemented chunk type, so ignore it: skip over the data*/
-    {
-      /*error: unknown critical chunk (5th bit of first byte of chunk type is 0)*/
-      if(!lodepng_chunk_ancillary(chunk)) CERROR_BREAK(state->error, 69);
+  }
+  return error;
+}
 
-      unknown = 1;
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-      if(state->decoder.remember_unknown_chunks)
-      {
-        state->error = lodepng_chunk_append(&state->info_png.unknown_chunks_data[critical_pos - 1],
-                                            &state->info_png.unknown_chunks_size[critical_pos - 1], chunk);
-        if(state->error) break;
-      }
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-    }
+/*whether the image is decoded with the pipeline: large, not interlaced, built-in zlib
+and no padding bits at the end of the rows*/
+static unsigned usePipeline(unsigned w, unsigned h, const LodePNGState* state)
+{
+  const LodePNGDecompressSettings* zlibsettings = &state->decoder.zlibsettings;
+  if(!state->decoder.pipeline || state->info_png.interlace_method != 0) return 0;
+  if(zlibsettings->custom_zlib || zlibsettings->custom_inflate) return 0;
+  if(((size_t)w * lodepng_get_bpp(&state->info_png.color)) % 8 != 0) return 0;
+  return getScanlinesSize(w, h, &state->info_png) >= PIPELINE_MIN_SIZE;
+}
 
-    if(!state->decoder.ignore_crc && !unknown) /*check CRC if wanted, only on known chunk types*/
-    {
-      if(lodepng_chunk_check_crc(chunk)) CERROR_BREAK(state->error, 57); /*invalid CRC*/
-    }
+/*
+Decodes the image with the pipeline. Returns 0 if the thread couldn't be started,
+the image must be decoded without the pipeline then, 1 otherwise with the result
+in error.
+*/
+static unsigned decodePipelined(unsigned* error, unsigned char* out, const ucvector* idat,
+                                unsigned w, unsigned h, const LodePNGState* state)
+{
+  Pipeline p;
+  unsigned started;
+  unsigned unfilter_error = 0;
+#ifdef _WIN32
+  HANDLE thread;
+#else /*_WIN32*/
+  pthread_t thread;
+#endif /*_WIN32*/
+
+  p.in = idat->data;
+  p.insize = idat->size;
+  p.settings = &state->decoder.zlibsettings;
+  p.predict = getScanlinesSize(w, h, &state->info_png);
+  p.ready = 0;
+  p.done = 0;
+  p.error = 0;
+  p.scanlines = (unsigned char*)arena_malloc(state->arena, p.predict);
+  if(!p.scanlines)
+  {
+    *error = 83; /*alloc fail*/
+    return 1;
+  }
+
+#ifdef _WIN32
+  InitializeCriticalSection(&p.lock);
+  InitializeConditionVariable(&p.cond);
+  thread = CreateThread(NULL, 0, Pipeline_thread, &p, 0, NULL);
+  started = thread != NULL;
+#else /*_WIN32*/
+  started = !pthread_mutex_init(&p.lock, NULL);
+  if(started && pthread_cond_init(&p.cond, NULL))
+  {
+    pthread_mutex_destroy(&p.lock);
+    started = 0;
+  }
+  if(started && pthread_create(&thread, NULL, Pipeline_thread, &p))
+  {
+    pthread_cond_destroy(&p.cond);
+    pthread_mutex_destroy(&p.lock);
+    started = 0;
+  }
+#endif /*_WIN32*/
+
+  if(started)
+  {
+    unfilter_error = Pipeline_unfilter(&p, out, w, h, state);
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else /*_WIN32*/
+    pthread_join(thread, NULL);
+    pthread_cond_destroy(&p.cond);
+    pthread_mutex_destroy(&p.lock);
+#endif /*_WIN32*/
+    /*like without the pipeline, zlib errors go before unfilter errors*/
+    *error = p.error ? p.error : unfilter_error;
+  }
+#ifdef _WIN32
+  DeleteCriticalSection(&p.lock);
+#endif /*_WIN32*/
+  arena_free(state->arena, p.scanlines);
+  return started;
+}
+#endif /*defined(LODEPNG_COMPILE_THREADS) && defined(LODEPNG_COMPILE_ZLIB)*/
 
-    if(!IEND) chunk = lodepng_chunk_next_const(chunk);
+/*
+Decodes the IDAT data into out, which has the size given by getDecodedSize. idat is
+freed once it's inflated, to not keep it during unfiltering. Return value is error.
+*/
+static unsigned decodeImage(unsigned char* out, ucvector* idat, unsigned w, unsigned h,
+                            const LodePNGState* state)
+{
+  unsigned error;
+  ucvector scanlines;
+#if defined(LODEPNG_COMPILE_THREADS) && defined(LODEPNG_COMPILE_ZLIB)
+  if(usePipeline(w, h, state) && decodePipelined(&error, out, idat, w, h, state))
+  {
+    ucvector_cleanup(idat);
+    return error;
   }
+#endif /*defined(LODEPNG_COMPILE_THREADS) && defined(LODEPNG_COMPILE_ZLIB)*/
+  ucvector_init_arena(&scanlines, state->arena);
+  error = inflateScanlines(&scanlines, idat, w, h, state);
+  ucvector_cleanup(idat);
+  if(!error) error = postProcessInto(out, &scanlines, w, h, state);
+  ucvector_cleanup(&scanlines);
+  return error;
+}
 
-  ucvector_init(&scanlines);
-  /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation.
-  If the decompressed size does not match the prediction, the image must be corrupt.*/
-  if(state->info_png.interlace_method == 0)
+unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
+                        LodePNGState* state,
+                        const unsigned char* in, size_t insize)
+{
+  ucvector idat; /*the data from idat chunks*/
+  size_t outsize;
+
+  *out = 0;
+  ucvector_init_arena(&idat, state->arena);
+  decodeChunks(&idat, w, h, state, in, insize);
+  if(!state->error) state->error = getDecodedSize(&outsize, *w, *h, state);
+  if(!state->error)
   {
-    /*The extra *h is added because this are the filter bytes every scanline starts with*/
-    predict = lodepng_get_raw_size_idat(*w, *h, &state->info_png.color) + *h;
+    *out = (unsigned char*)lodepng_malloc(outsize);
+    if(!(*out)) state->error = 83; /*alloc fail*/
   }
-  else
-  {
-    /*Adam-7 interlaced: predicted size is the sum of the 7 sub-images sizes*/
-    const LodePNGColorMode* color = &state->info_png.color;
-    predict = 0;
-    predict += lodepng_get_raw_size_idat((*w + 7) >> 3, (*h + 7) >> 3, color) + ((*h + 7) >> 3);
-    if(*w > 4) predict += lodepng_get_raw_size_idat((*w + 3) >> 3, (*h + 7) >> 3, color) + ((*h + 7) >> 3);
-    predict += lodepng_get_raw_size_idat((*w + 3) >> 2, (*h + 3) >> 3, color) + ((*h + 3) >> 3);
-    if(*w > 2) predict += lodepng_get_raw_size_idat((*w + 1) >> 2, (*h + 3) >> 2, color) + ((*h + 3) >> 2);
-    predict += lodepng_get_raw_size_idat((*w + 1) >> 1, (*h + 1) >> 2, color) + ((*h + 1) >> 2);
-    if(*w > 1) predict += lodepng_get_raw_size_idat((*w + 0) >> 1, (*h + 1) >> 1, color) + ((*h + 1) >> 1);
-    predict += lodepng_get_raw_size_idat((*w + 0), (*h + 0) >> 1, color) + ((*h + 0) >> 1);
-  }
-  if(!state->error && !ucvector_reserve(&scanlines, predict)) state->error = 83; /*alloc fail*/
   if(!state->error)
   {
-    state->error = zlib_decompress(&scanlines.data, &scanlines.size, idat.data,
-                                   idat.size, &state->decoder.zlibsettings);
-    if(!state->error && scanlines.size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
+    state->error = decodeImage(*out, &idat, *w, *h, state);
+    if(state->error)
+    {
+      lodepng_free(*out);
+      *out = 0;
+    }
   }
   ucvector_cleanup(&idat);
+  return state->error;
+}
 
-  if(!state->error)
+unsigned lodepng_decode_into(unsigned char* out, size_t outsize, unsigned* w, unsigned* h,
+                             LodePNGState* state,
+                             const unsigned char* in, size_t insize)
+{
+  ucvector idat; /*the data from idat chunks*/
+  size_t needed;
+
+  ucvector_init_arena(&idat, state->arena);
+  decodeChunks(&idat, w, h, state, in, insize);
+  if(!state->error) state->error = getDecodedSize(&needed, *w, *h, state);
+  if(!state->error && outsize < needed) state->error = 95; /*the caller's buffer is too small*/
+  if(!state->error) state->error = decodeImage(out, &idat, *w, *h, state);
+  ucvector_cleanup(&idat);
+  return state->error;
+}
+
+#ifdef LODEPNG_COMPILE_ZLIB
+struct LodePNGStreamDecoder
+{
+  LodePNGState* state;
+  LodePNGRowCallback callback;
+  void* user;
+  ucvector in; /*input that is not handled yet, such as a chunk that didn't fully arrive*/
+  unsigned w, h;
+  unsigned header; /*whether the signature and IHDR were read*/
+  unsigned started; /*whether the output rows are set up, done at the first IDAT*/
+  unsigned char IEND;
+  unsigned unknown, critical_pos; /*see readChunk*/
+  unsigned in_idat; /*whether the data of an IDAT chunk is being received*/
+  size_t idat_left; /*bytes of the data of the current IDAT chunk that didn't arrive yet*/
+  unsigned idat_crc; /*CRC of the current IDAT chunk up to here*/
+  ZlibStream zlib;
+  size_t predict; /*size the inflated data must have*/
+  size_t used; /*amount of bytes at the start of zlib.out that were already output*/
+  unsigned y; /*next row to output*/
+  size_t linebytes; /*bytes of a scanline without filter byte*/
+  size_t rowbytes; /*bytes of an output row*/
+  unsigned convert; /*whether the rows must be converted to info_raw*/
+  unsigned char* rows; /*the current and previous unfiltered scanline, and a row in the info_raw color mode*/
+};
+
+/*Sets up the output once all chunks before the IDAT data, such as PLTE and tRNS, are known.*/
+static unsigned streamStart(LodePNGStreamDecoder* d)
+{
+  LodePNGState* state = d->state;
+  size_t rawsize;
+
+  CERROR_TRY_RETURN(getDecodedSize(&rawsize, d->w, d->h, state));
+  d->convert = !lodepng_color_mode_equal(&state->info_raw, &state->info_png.color);
+  d->predict = getScanlinesSize(d->w, d->h, &state->info_png);
+  d->linebytes = lodepng_get_raw_size_idat(d->w, 1, &state->info_png.color);
+  d->rowbytes = lodepng_get_raw_size(d->w, 1, &state->info_raw);
+  d->rows = (unsigned char*)lodepng_malloc(d->linebytes * 2 + d->rowbytes);
+  if(!d->rows) return 83; /*alloc fail*/
+  d->started = 1;
+  return 0;
+}
+
+/*Unfilters and outputs the scanlines that are completely inflated, for non-interlaced images.*/
+static unsigned streamOutputRows(LodePNGStreamDecoder* d)
+{
+  LodePNGState* state = d->state;
+  size_t bytewidth = (lodepng_get_bpp(&state->info_png.color) + 7) / 8;
+  while(d->y < d->h && d->zlib.out.size - d->used >= d->linebytes + 1)
   {
-    size_t outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
-    *out = (unsigned char*)lodepng_malloc(outsize);
-    if(!*out) state->error = 83; /*alloc fail*/
-    for(i = 0; i < outsize; i++) (*out)[i] = 0;
-    if(!state->error) state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png);
+    unsigned char* recon = &d->rows[(d->y & 1) * d->linebytes];
+    const unsigned char* precon = d->y ? &d->rows[((d->y & 1) ^ 1) * d->linebytes] : 0;
+    const unsigned char* scanline = &d->zlib.out.data[d->used];
+    unsigned char* row = recon;
+
+    CERROR_TRY_RETURN(unfilterScanline(recon, &scanline[1], precon, bytewidth, scanline[0], d->linebytes));
+    if(d->convert)
+    {
+      row = &d->rows[d->linebytes * 2];
+      CERROR_TRY_RETURN(lodepng_convert(row, recon, &state->info_raw, &state->info_png.color, d->w, 1));
+    }
+    CERROR_TRY_RETURN(d->callback(d->user, row, d->y, d->w, d->h));
+    d->used += d->linebytes + 1;
+    ++d->y;
   }
-  ucvector_cleanup(&scanlines);
+  d->used -= ZlibStream_discard(&d->zlib, d->used);
+  return 0;
 }
 
-unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
-                        LodePNGState* state,
-                        const unsigned char* in, size_t insize)
+/*Adam7 passes only give complete rows at the end, so interlaced images are output all at once.*/
+static unsigned streamOutputInterlaced(LodePNGStreamDecoder* d)
 {
-  *out = 0;
-  decodeGeneric(out, w, h, state, in, insize);
-  if(state->error) return state->error;
-  if(!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
+  LodePNGState* state = d->state;
+  unsigned error;
+  size_t bits = (size_t)d->w * lodepng_get_bpp(&state->info_raw);
+  unsigned char* image = (unsigned char*)lodepng_malloc(lodepng_get_raw_size(d->w, d->h, &state->info_raw));
+  if(!image) return 83; /*alloc fail*/
+
+  error = postProcessInto(image, &d->zlib.out, d->w, d->h, state);
+  for(; !error && d->y < d->h; ++d->y)
   {
-    /*same color type, no copying or converting of data needed*/
-    /*store the info_png color settings on the info_raw so that the info_raw still reflects what colortype
-    the raw image has to the end user*/
-    if(!state->decoder.color_convert)
+    const unsigned char* row = &image[d->y * d->rowbytes];
+    if(bits % 8 != 0)
     {
-      state->error = lodepng_color_mode_copy(&state->info_raw, &state->info_png.color);
-      if(state->error) return state->error;
+      /*the image has no padding bits between rows, but every row given to the callback starts at a byte*/
+      size_t ibp = d->y * bits, obp = 0, x;
+      unsigned char* dest = &d->rows[d->linebytes * 2];
+      memset(dest, 0, d->rowbytes);
+      for(x = 0; x < bits; ++x) setBitOfReversedStream0(&obp, dest, readBitFromReversedStream(&ibp, image));
+      row = dest;
     }
+    error = d->callback(d->user, row, d->y, d->w, d->h);
   }
-  else
+  lodepng_free(image);
+  return error;
+}
+
+/*Reads the chunks in d->in as far as they arrived, IDAT data goes to the inflater.*/
+static unsigned streamReadChunks(LodePNGStreamDecoder* d)
+{
+  LodePNGState* state = d->state;
+  const unsigned char* in = d->in.data;
+  size_t size = d->in.size, pos = 0;
+
+  if(!d->header)
   {
-    /*color conversion needed; sort of copy of the data*/
-    unsigned char* data = *out;
-    size_t outsize;
+    size_t numpixels;
+    if(size < 33) return 0;
+    CERROR_TRY_RETURN(lodepng_inspect(&d->w, &d->h, state, in, size));
+    numpixels = (size_t)d->w * d->h;
+    /*multiplication overflow, and the same limit as lodepng_decode*/
+    if(numpixels / d->h != d->w || numpixels > 268435455) return 92;
+    d->header = 1;
+    pos = 33;
+  }
 
-    /*TODO: check if this works according to the statement in the documentation: "The converter can convert
-    from greyscale input color type, to 8-bit greyscale or greyscale with alpha"*/
-    if(!(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
-       && !(state->info_raw.bitdepth == 8))
+  while(!d->IEND)
+  {
+    unsigned chunkLength;
+    if(d->in_idat)
     {
-      return 56; /*unsupported color mode conversion*/
+      size_t amount = size - pos < d->idat_left ? size - pos : d->idat_left;
+      size_t oldsize = d->zlib.in.size;
+      if(!ucvector_resize(&d->zlib.in, oldsize + amount)) return 83; /*alloc fail*/
+      if(amount) memcpy(&d->zlib.in.data[oldsize], &in[pos], amount);
+#ifndef LODEPNG_NO_COMPILE_CRC
+      d->idat_crc = update_crc32(d->idat_crc, &in[pos], amount);
+#endif /*LODEPNG_NO_COMPILE_CRC*/
+      pos += amount;
+      d->idat_left -= amount;
+      if(d->idat_left || size - pos < 4) break;
+      if(!state->decoder.ignore_crc && !d->unknown && lodepng_read32bitInt(&in[pos]) != d->idat_crc)
+      {
+        return 57; /*invalid CRC*/
+      }
+      pos += 4;
+      d->in_idat = 0;
+      continue;
     }
 
-    outsize = lodepng_get_raw_size(*w, *h, &state->info_raw);
-    *out = (unsigned char*)lodepng_malloc(outsize);
-    if(!(*out))
+    if(size - pos < 12) break;
+    chunkLength = lodepng_chunk_length(&in[pos]);
+    /*error: chunk length larger than the max PNG chunk size*/
+    if(chunkLength > 2147483647) return 63;
+
+#ifndef LODEPNG_NO_COMPILE_CRC
+    /*IDAT data is inflated as it arrives. A custom lodepng_crc32 can't be continued, so then it waits for the
+    whole chunk like the other chunks do*/
+    if(lodepng_chunk_type_equals(&in[pos], "IDAT"))
     {
-      state->error = 83; /*alloc fail*/
+      d->in_idat = 1;
+      d->idat_left = chunkLength;
+      d->idat_crc = update_crc32(0, &in[pos + 4], 4);
+      d->critical_pos = 3;
+      pos += 8;
+      continue;
     }
-    else state->error = lodepng_convert(*out, data, &state->info_raw,
-                                        &state->info_png.color, *w, *h);
-    lodepng_free(data);
+#endif /*LODEPNG_NO_COMPILE_CRC*/
+
+    if(size - pos < (size_t)chunkLength + 12) break;
+    CERROR_TRY_RETURN(readChunk(state, &d->zlib.in, &in[pos], &d->IEND, &d->unknown, &d->critical_pos));
+    pos += (size_t)chunkLength + 12;
+  }
+
+  /*keep only the part that isn't handled yet, everything after IEND is ignored*/
+  if(d->IEND) d->in.size = 0;
+  else if(pos)
+  {
+    memmove(d->in.data, &d->in.data[pos], size - pos);
+    d->in.size = size - pos;
   }
+  return 0;
+}
+
+LodePNGStreamDecoder* lodepng_stream_decoder_new(LodePNGState* state, LodePNGRowCallback callback, void* user)
+{
+  LodePNGStreamDecoder* d = (LodePNGStreamDecoder*)lodepng_malloc(sizeof(LodePNGStreamDecoder));
+  if(!d) return 0;
+  d->state = state;
+  d->callback = callback;
+  d->user = user;
+  ucvector_init(&d->in);
+  d->w = d->h = 0;
+  d->header = d->started = 0;
+  d->IEND = 0;
+  d->unknown = 0;
+  d->critical_pos = 1;
+  d->in_idat = 0;
+  d->idat_left = 0;
+  d->idat_crc = 0;
+  ZlibStream_init(&d->zlib);
+  d->predict = d->used = 0;
+  d->y = 0;
+  d->linebytes = d->rowbytes = 0;
+  d->convert = 0;
+  d->rows = 0;
+  state->error = 0;
+  return d;
+}
+
+void lodepng_stream_decoder_delete(LodePNGStreamDecoder* d)
+{
+  if(!d) return;
+  ucvector_cleanup(&d->in);
+  ZlibStream_cleanup(&d->zlib);
+  lodepng_free(d->rows);
+  lodepng_free(d);
+}
+
+unsigned lodepng_stream_decoder_push(LodePNGStreamDecoder* d, const unsigned char* in, size_t insize)
+{
+  LodePNGState* state = d->state;
+  const LodePNGDecompressSettings* settings = &state->decoder.zlibsettings;
+  size_t oldsize = d->in.size;
+
+  if(state->error || d->IEND) return state->error;
+
+  if(!ucvector_resize(&d->in, oldsize + insize)) CERROR_RETURN_ERROR(state->error, 83); /*alloc fail*/
+  if(insize) memcpy(&d->in.data[oldsize], in, insize);
+
+  state->error = streamReadChunks(d);
+  if(!state->error && !d->started && (d->critical_pos == 3 || d->IEND)) state->error = streamStart(d);
+  if(state->error || !d->started) return state->error;
+
+  state->error = ZlibStream_inflate(&d->zlib, d->IEND, settings);
+  /*if the decompressed size does not match the prediction, the image must be corrupt*/
+  if(!state->error && d->IEND && d->zlib.outtotal != d->predict) state->error = 91;
+  if(!state->error && state->info_png.interlace_method == 0) state->error = streamOutputRows(d);
+  else if(!state->error && d->IEND) state->error = streamOutputInterlaced(d);
   return state->error;
 }
 
+unsigned lodepng_stream_decoder_finish(LodePNGStreamDecoder* d)
+{
+  /*error: the input ended before the IEND chunk*/
+  if(!d->state->error && !d->IEND) d->state->error = 30;
+  return d->state->error;
+}
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
 unsigned lodepng_decode_memory(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in,
                                size_t insize, LodePNGColorType colortype, unsigned bitdepth)
 {
@@ -4718,12 +7148,13 @@ unsigned lodepng_decode24(unsigned char** out, unsigned* w, unsigned* h, const u
 unsigned lodepng_decode_file(unsigned char** out, unsigned* w, unsigned* h, const char* filename,
                              LodePNGColorType colortype, unsigned bitdepth)
 {
-  unsigned char* buffer;
-  size_t buffersize;
+  LodePNGFileMap file;
   unsigned error;
-  error = lodepng_load_file(&buffer, &buffersize, filename);
-  if(!error) error = lodepng_decode_memory(out, w, h, buffer, buffersize, colortype, bitdepth);
-  lodepng_free(buffer);
+  *out = 0;
+  error = lodepng_map_file(&file, filename);
+  if(error) return error;
+  error = lodepng_decode_memory(out, w, h, file.data, file.size, colortype, bitdepth);
+  lodepng_unmap_file(&file);
   return error;
 }
 
@@ -4746,6 +7177,7 @@ void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings)
   settings->remember_unknown_chunks = 0;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
   settings->ignore_crc = 0;
+  settings->pipeline = 0;
   lodepng_decompress_settings_init(&settings->zlibsettings);
 }
 
@@ -4764,6 +7196,7 @@ void lodepng_state_init(LodePNGState* state)
   lodepng_color_mode_init(&state->info_raw);
   lodepng_info_init(&state->info_png);
   state->error = 1;
+  state->arena = 0;
 }
 
 void lodepng_state_cleanup(LodePNGState* state)
@@ -5067,10 +7500,110 @@ static unsigned addChunk_pHYs(ucvector* out, const LodePNGInfo* info)
 
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
+/*the prediction of filter type 1-4 from the bytes left (a), above (b) and above left (c)*/
+static unsigned char filterPredictor(unsigned char filterType, unsigned char a, unsigned char b, unsigned char c)
+{
+  switch(filterType)
+  {
+    case 1: return a;
+    case 2: return b;
+    case 3: return (unsigned char)((a + b) >> 1);
+    case 4: return paethPredictor(a, b, c);
+    default: return 0;
+  }
+}
+
+#ifdef LODEPNG_COMPILE_SSE2
+/*
+SSE2 filtering. Unlike unfiltering, filtering only reads the unfiltered bytes, so there
+is no dependency between the bytes of a scanline and 16 are done at once, from the
+bytes themselves (x) and those left (a), above (b) and above left (c) of them.
+*/
+static __m128i filterAbs16(__m128i v)
+{
+  return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+static __m128i filterSelect(__m128i condition, __m128i t, __m128i e)
+{
+  return _mm_or_si128(_mm_and_si128(condition, t), _mm_andnot_si128(condition, e));
+}
+
+/*Paeth predictor of 8 bytes widened to 16 bits, ties broken like paethPredictor*/
+static __m128i filterPaeth8(__m128i a, __m128i b, __m128i c)
+{
+  __m128i pa = _mm_sub_epi16(b, c);
+  __m128i pb = _mm_sub_epi16(a, c);
+  __m128i pc = filterAbs16(_mm_add_epi16(pa, pb));
+  __m128i smallest;
+  pa = filterAbs16(pa);
+  pb = filterAbs16(pb);
+  smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+  return filterSelect(_mm_cmpeq_epi16(smallest, pa), a, filterSelect(_mm_cmpeq_epi16(smallest, pb), b, c));
+}
+
+static __m128i filterSSE2(unsigned char filterType, __m128i x, __m128i a, __m128i b, __m128i c)
+{
+  const __m128i zero = _mm_setzero_si128();
+  switch(filterType)
+  {
+    case 1: return _mm_sub_epi8(x, a);
+    case 2: return _mm_sub_epi8(x, b);
+    case 3: /*_mm_avg_epu8 rounds up, subtracting the lsb of a ^ b makes it round down*/
+      return _mm_sub_epi8(x, _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1))));
+    case 4:
+      return _mm_sub_epi8(x, _mm_packus_epi16(
+          filterPaeth8(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero)),
+          filterPaeth8(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero))));
+    default: return x;
+  }
+}
+
+/*loads the 16 bytes left, above and above left of scanline[i], i must be at least bytewidth*/
+static void filterLoadSSE2(__m128i* x, __m128i* a, __m128i* b, __m128i* c, const unsigned char* scanline,
+                           const unsigned char* prevline, size_t i, size_t bytewidth)
+{
+  *x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+  *a = _mm_loadu_si128((const __m128i*)&scanline[i - bytewidth]);
+  *b = prevline ? _mm_loadu_si128((const __m128i*)&prevline[i]) : _mm_setzero_si128();
+  *c = prevline ? _mm_loadu_si128((const __m128i*)&prevline[i - bytewidth]) : _mm_setzero_si128();
+}
+
+/*filter types 1-4, the scanline must be at least bytewidth + 16 bytes*/
+static void filterScanlineSSE2(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                               size_t length, size_t bytewidth, unsigned char filterType)
+{
+  size_t i;
+  /*the first pixel has no left neighbours, the prediction then uses 0 for them*/
+  for(i = 0; i != bytewidth; ++i)
+  {
+    out[i] = scanline[i] - filterPredictor(filterType, 0, prevline ? prevline[i] : 0, 0);
+  }
+  for(; i + 16 <= length; i += 16)
+  {
+    __m128i x, a, b, c;
+    filterLoadSSE2(&x, &a, &b, &c, scanline, prevline, i, bytewidth);
+    _mm_storeu_si128((__m128i*)&out[i], filterSSE2(filterType, x, a, b, c));
+  }
+  for(; i != length; ++i)
+  {
+    out[i] = scanline[i] - filterPredictor(filterType, scanline[i - bytewidth],
+                                           prevline ? prevline[i] : 0, prevline ? prevline[i - bytewidth] : 0);
+  }
+}
+#endif /*LODEPNG_COMPILE_SSE2*/
+
 static void filterScanline(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
                            size_t length, size_t bytewidth, unsigned char filterType)
 {
   size_t i;
+#ifdef LODEPNG_COMPILE_SSE2
+  if(filterType >= 1 && filterType <= 4 && length >= bytewidth + 16)
+  {
+    filterScanlineSSE2(out, scanline, prevline, length, bytewidth, filterType);
+    return;
+  }
+#endif /*LODEPNG_COMPILE_SSE2*/
   switch(filterType)
   {
     case 0: /*None*/
@@ -5132,6 +7665,63 @@ static float flog2(float f)
   return result + 1.442695f * (f * f * f / 3 - 3 * f * f / 2 + 3 * f - 1.83333f);
 }
 
+/*adds the minimum sum heuristic value of scanline[i] filtered with each type to sum*/
+static void filterSumsByte(size_t sum[5], const unsigned char* scanline, const unsigned char* prevline,
+                           size_t i, size_t bytewidth)
+{
+  unsigned char type;
+  unsigned char a = i >= bytewidth ? scanline[i - bytewidth] : 0;
+  unsigned char b = prevline ? prevline[i] : 0;
+  unsigned char c = prevline && i >= bytewidth ? prevline[i - bytewidth] : 0;
+  sum[0] += scanline[i];
+  for(type = 1; type != 5; ++type)
+  {
+    unsigned char s = (unsigned char)(scanline[i] - filterPredictor(type, a, b, c));
+    sum[type] += s < 128 ? s : (255U - s);
+  }
+}
+
+/*
+The sums of the minimum sum heuristic for all 5 filter types of a scanline, computed in
+one pass without storing the filtered scanlines.
+*/
+static void filterSums(size_t sum[5], const unsigned char* scanline, const unsigned char* prevline,
+                       size_t length, size_t bytewidth)
+{
+  size_t i = 0;
+  unsigned char type;
+  for(type = 0; type != 5; ++type) sum[type] = 0;
+  for(; i != bytewidth && i != length; ++i) filterSumsByte(sum, scanline, prevline, i, bytewidth);
+#ifdef LODEPNG_COMPILE_SSE2
+  while(i + 16 <= length)
+  {
+    /*_mm_sad_epu8 gives two sums of 8 bytes; 4096 steps of 16 bytes stay within 32 bits*/
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc[5];
+    size_t end = length - i > 65536 ? i + 65536 : length;
+    for(type = 0; type != 5; ++type) acc[type] = zero;
+    for(; i + 16 <= end; i += 16)
+    {
+      __m128i x, a, b, c;
+      filterLoadSSE2(&x, &a, &b, &c, scanline, prevline, i, bytewidth);
+      acc[0] = _mm_add_epi32(acc[0], _mm_sad_epu8(x, zero));
+      for(type = 1; type != 5; ++type)
+      {
+        /*as signed bytes, values above 127 count as 255 - s: flip their bits*/
+        __m128i s = filterSSE2(type, x, a, b, c);
+        s = _mm_xor_si128(s, _mm_cmplt_epi8(s, zero));
+        acc[type] = _mm_add_epi32(acc[type], _mm_sad_epu8(s, zero));
+      }
+    }
+    for(type = 0; type != 5; ++type)
+    {
+      sum[type] += (unsigned)_mm_cvtsi128_si32(acc[type]) + (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(acc[type], 8));
+    }
+  }
+#endif /*LODEPNG_COMPILE_SSE2*/
+  for(; i < length; ++i) filterSumsByte(sum, scanline, prevline, i, bytewidth);
+}
+
 static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
                        const LodePNGColorMode* info, const LodePNGEncoderSettings* settings)
 {
@@ -5182,62 +7772,29 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
   }
   else if(strategy == LFS_MINSUM)
   {
-    /*adaptive filtering*/
+    /*adaptive filtering: the filter type with the smallest sum, the first one of equal sums*/
     size_t sum[5];
-    unsigned char* attempt[5]; /*five filtering attempts, one for each filter type*/
-    size_t smallest = 0;
-    unsigned char type, bestType = 0;
-
-    for(type = 0; type != 5; ++type)
-    {
-      attempt[type] = (unsigned char*)lodepng_malloc(linebytes);
-      if(!attempt[type]) return 83; /*alloc fail*/
-    }
+    size_t smallest;
+    unsigned char type, bestType;
 
-    if(!error)
+    for(y = 0; y != h; ++y)
     {
-      for(y = 0; y != h; ++y)
+      filterSums(sum, &in[y * linebytes], prevline, linebytes, bytewidth);
+      bestType = 0;
+      smallest = sum[0];
+      for(type = 1; type != 5; ++type)
       {
-        /*try the 5 filter types*/
-        for(type = 0; type != 5; ++type)
+        if(sum[type] < smallest)
         {
-          filterScanline(attempt[type], &in[y * linebytes], prevline, linebytes, bytewidth, type);
-
-          /*calculate the sum of the result*/
-          sum[type] = 0;
-          if(type == 0)
-          {
-            for(x = 0; x != linebytes; ++x) sum[type] += (unsigned char)(attempt[type][x]);
-          }
-          else
-          {
-            for(x = 0; x != linebytes; ++x)
-            {
-              /*For differences, each byte should be treated as signed, values above 127 are negative
-              (converted to signed char). Filtertype 0 isn't a difference though, so use unsigned there.
-              This means filtertype 0 is almost never chosen, but that is justified.*/
-              unsigned char s = attempt[type][x];
-              sum[type] += s < 128 ? s : (255U - s);
-            }
-          }
-
-          /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
-          if(type == 0 || sum[type] < smallest)
-          {
-            bestType = type;
-            smallest = sum[type];
-          }
+          bestType = type;
+          smallest = sum[type];
         }
-
-        prevline = &in[y * linebytes];
-
-        /*now fill the out values*/
-        out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
-        for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType][x];
       }
-    }
 
-    for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
+      out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
+      filterScanline(&out[y * (linebytes + 1) + 1], &in[y * linebytes], prevline, linebytes, bytewidth, bestType);
+      prevline = &in[y * linebytes];
+    }
   }
   else if(strategy == LFS_ENTROPY)
   {
@@ -5246,6 +7803,15 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     float smallest = 0;
     unsigned type, bestType = 0;
     unsigned count[256];
+    /*the entropy term of each possible count, a row of linebytes + 1 bytes has only so many*/
+    float* term = (float*)lodepng_malloc(sizeof(float) * (linebytes + 2));
+    if(!term) return 83; /*alloc fail*/
+    term[0] = 0;
+    for(x = 1; x != linebytes + 2; ++x)
+    {
+      float p = x / (float)(linebytes + 1);
+      term[x] = flog2(1 / p) * p;
+    }
 
     for(type = 0; type != 5; ++type)
     {
@@ -5263,11 +7829,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
         for(x = 0; x != linebytes; ++x) ++count[attempt[type][x]];
         ++count[type]; /*the filter type itself is part of the scanline*/
         sum[type] = 0;
-        for(x = 0; x != 256; ++x)
-        {
-          float p = count[x] / (float)(linebytes + 1);
-          sum[type] += count[x] == 0 ? 0 : flog2(1 / p) * p;
-        }
+        for(x = 0; x != 256; ++x) sum[type] += term[count[x]];
         /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
         if(type == 0 || sum[type] < smallest)
         {
@@ -5284,6 +7846,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     }
 
     for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
+    lodepng_free(term);
   }
   else if(strategy == LFS_PREDEFINED)
   {
@@ -5436,9 +7999,11 @@ static void Adam7_interlace(unsigned char* out, const unsigned char* in, unsigne
 
 /*out must be buffer big enough to contain uncompressed IDAT chunk data, and in must contain the full image.
 return value is error**/
+/*out and the buffers in between are allocated from arena, which may be 0*/
 static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const unsigned char* in,
                                     unsigned w, unsigned h,
-                                    const LodePNGInfo* info_png, const LodePNGEncoderSettings* settings)
+                                    const LodePNGInfo* info_png, const LodePNGEncoderSettings* settings,
+                                    LodePNGArena* arena)
 {
   /*
   This function converts the pure 2D image with the PNG's colortype, into filtered-padded-interlaced data. Steps:
@@ -5451,7 +8016,7 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
   if(info_png->interlace_method == 0)
   {
     *outsize = h + (h * ((w * bpp + 7) / 8)); /*image size plus an extra byte per scanline + possible padding bits*/
-    *out = (unsigned char*)lodepng_malloc(*outsize);
+    *out = (unsigned char*)arena_malloc(arena, *outsize);
     if(!(*out) && (*outsize)) error = 83; /*alloc fail*/
 
     if(!error)
@@ -5459,14 +8024,14 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
       /*non multiple of 8 bits per scanline, padding bits needed per scanline*/
       if(bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8)
       {
-        unsigned char* padded = (unsigned char*)lodepng_malloc(h * ((w * bpp + 7) / 8));
+        unsigned char* padded = (unsigned char*)arena_malloc(arena, h * ((w * bpp + 7) / 8));
         if(!padded) error = 83; /*alloc fail*/
         if(!error)
         {
           addPaddingBits(padded, in, ((w * bpp + 7) / 8) * 8, w * bpp, h);
           error = filter(*out, padded, w, h, &info_png->color, settings);
         }
-        lodepng_free(padded);
+        arena_free(arena, padded);
       }
       else
       {
@@ -5484,10 +8049,10 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
     Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
 
     *outsize = filter_passstart[7]; /*image size plus an extra byte per scanline + possible padding bits*/
-    *out = (unsigned char*)lodepng_malloc(*outsize);
+    *out = (unsigned char*)arena_malloc(arena, *outsize);
     if(!(*out)) error = 83; /*alloc fail*/
 
-    adam7 = (unsigned char*)lodepng_malloc(passstart[7]);
+    adam7 = (unsigned char*)arena_malloc(arena, passstart[7]);
     if(!adam7 && passstart[7]) error = 83; /*alloc fail*/
 
     if(!error)
@@ -5499,13 +8064,13 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
       {
         if(bpp < 8)
         {
-          unsigned char* padded = (unsigned char*)lodepng_malloc(padded_passstart[i + 1] - padded_passstart[i]);
+          unsigned char* padded = (unsigned char*)arena_malloc(arena, padded_passstart[i + 1] - padded_passstart[i]);
           if(!padded) ERROR_BREAK(83); /*alloc fail*/
           addPaddingBits(padded, &adam7[passstart[i]],
                          ((passw[i] * bpp + 7) / 8) * 8, passw[i] * bpp, passh[i]);
           error = filter(&(*out)[filter_passstart[i]], padded,
                          passw[i], passh[i], &info_png->color, settings);
-          lodepng_free(padded);
+          arena_free(arena, padded);
         }
         else
         {
@@ -5517,7 +8082,7 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
       }
     }
 
-    lodepng_free(adam7);
+    arena_free(arena, adam7);
   }
 
   return error;
@@ -5612,16 +8177,19 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
     unsigned char* converted;
     size_t size = (w * h * lodepng_get_bpp(&info.color) + 7) / 8;
 
-    converted = (unsigned char*)lodepng_malloc(size);
+    converted = (unsigned char*)arena_malloc(state->arena, size);
     if(!converted && size) state->error = 83; /*alloc fail*/
     if(!state->error)
     {
       state->error = lodepng_convert(converted, image, &info.color, &state->info_raw, w, h);
     }
-    if(!state->error) preProcessScanlines(&data, &datasize, converted, w, h, &info, &state->encoder);
-    lodepng_free(converted);
+    if(!state->error)
+    {
+      state->error = preProcessScanlines(&data, &datasize, converted, w, h, &info, &state->encoder, state->arena);
+    }
+    arena_free(state->arena, converted);
   }
-  else preProcessScanlines(&data, &datasize, image, w, h, &info, &state->encoder);
+  else state->error = preProcessScanlines(&data, &datasize, image, w, h, &info, &state->encoder, state->arena);
 
   ucvector_init(&outv);
   while(!state->error) /*while only executed once, to break on error*/
@@ -5748,7 +8316,7 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
   }
 
   lodepng_info_cleanup(&info);
-  lodepng_free(data);
+  arena_free(state->arena, data);
   /*instead of cleaning the vector up, give it to the output*/
   *out = outv.data;
   *outsize = outv.size;
@@ -5924,6 +8492,7 @@ const char* lodepng_error_text(unsigned code)
     case 92: return "too many pixels, not supported";
     case 93: return "zero width or height is invalid";
     case 94: return "header chunk must have a size of 13 bytes";
+    case 95: return "output buffer given to lodepng_decode_into is too small for the decoded image";
   }
   return "unknown error code";
 }
@@ -5942,18 +8511,12 @@ namespace lodepng
 #ifdef LODEPNG_COMPILE_DISK
 unsigned load_file(std::vector<unsigned char>& buffer, const std::string& filename)
 {
-  std::ifstream file(filename.c_str(), std::ios::in|std::ios::binary|std::ios::ate);
-  if(!file) return 78;
-
-  /*get filesize*/
-  std::streamsize size = 0;
-  if(file.seekg(0, std::ios::end).good()) size = file.tellg();
-  if(file.seekg(0, std::ios::beg).good()) size -= file.tellg();
-
-  /*read contents of the file into the vector*/
-  buffer.resize(size_t(size));
-  if(size > 0) file.read((char*)(&buffer[0]), size);
-
+  LodePNGFileMap file;
+  unsigned error = lodepng_map_file(&file, filename.c_str());
+  if(error) return error;
+  /*the only copy: from the mapped page cache into the vector*/
+  buffer.assign(file.data, file.data + file.size);
+  lodepng_unmap_file(&file);
   return 0; /* OK */
 }
 
@@ -6089,10 +8652,12 @@ unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h, const std::string& filename,
                 LodePNGColorType colortype, unsigned bitdepth)
 {
-  std::vector<unsigned char> buffer;
-  unsigned error = load_file(buffer, filename);
+  LodePNGFileMap file;
+  unsigned error = lodepng_map_file(&file, filename.c_str());
   if(error) return error;
-  return decode(out, w, h, buffer, colortype, bitdepth);
+  error = decode(out, w, h, file.data, file.size, colortype, bitdepth);
+  lodepng_unmap_file(&file);
+  return error;
 }
 #endif /* LODEPNG_COMPILE_DECODER */
 #endif /* LODEPNG_COMPILE_DISK */
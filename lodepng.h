@@ -60,6 +60,20 @@ the custom_zlib field of the compress and decompress settings*/
 #ifndef LODEPNG_NO_COMPILE_DISK
 #define LODEPNG_COMPILE_DISK
 #endif
+/*load files by mapping them into memory (mmap, or MapViewOfFile on Windows) instead
+of reading them into an allocated buffer, on the platforms that support it*/
+#ifndef LODEPNG_NO_COMPILE_MMAP
+#if defined(_WIN32) || defined(__unix__) || defined(__APPLE__)
+#define LODEPNG_COMPILE_MMAP
+#endif
+#endif
+/*threads for the pipeline decoder and numthreads compression settings, with Windows
+threads or pthreads (link with -pthread then), on the platforms that have them*/
+#ifndef LODEPNG_NO_COMPILE_THREADS
+#if defined(_WIN32) || defined(__unix__) || defined(__APPLE__)
+#define LODEPNG_COMPILE_THREADS
+#endif
+#endif
 /*support for chunks other than IHDR, IDAT, PLTE, tRNS, IEND: ancillary and unknown chunks*/
 #ifndef LODEPNG_NO_COMPILE_ANCILLARY_CHUNKS
 #define LODEPNG_COMPILE_ANCILLARY_CHUNKS
@@ -74,6 +88,13 @@ source files with custom allocators.*/
 #ifndef LODEPNG_NO_COMPILE_ALLOCATORS
 #define LODEPNG_COMPILE_ALLOCATORS
 #endif
+/*SSE2 code paths, used on x86 and x86-64 targets compiled with SSE2 support (every
+x86-64 CPU has it). Define LODEPNG_NO_COMPILE_SSE2 to only use the portable C code.*/
+#ifndef LODEPNG_NO_COMPILE_SSE2
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LODEPNG_COMPILE_SSE2
+#endif
+#endif
 /*compile the C++ version (you can disable the C++ wrapper here even when compiling for C++)*/
 #ifdef __cplusplus
 #ifndef LODEPNG_NO_COMPILE_CPP
@@ -250,6 +271,35 @@ unsigned encode(const std::string& filename,
 const char* lodepng_error_text(unsigned code);
 #endif /*LODEPNG_COMPILE_ERROR_TEXT*/
 
+/*
+Arena: a block of memory handed out by bumping a pointer, for the scratch buffers
+of a decode or encode (the IDAT data, the inflated scanlines, interlacing and
+conversion buffers), so batch loading many images reuses the same memory instead
+of going through the heap for every image. Set it in LodePNGState.arena, and call
+lodepng_arena_reset between images: that makes all memory of the arena available
+again at once. Buffers returned to the user, like the decoded image, are never in
+the arena. If a buffer doesn't fit in the free space, it comes from the heap as
+usual, so the capacity only affects how much the arena saves. peak tells the most
+memory in use at once since init, to tune the capacity.
+An arena must not be used by two decodes or encodes at the same time.
+*/
+typedef struct LodePNGArena
+{
+  unsigned char* data;
+  size_t capacity;
+  size_t used;
+  size_t peak;
+  unsigned owned; /*whether data was allocated by lodepng_arena_init*/
+} LodePNGArena;
+
+/*allocates capacity bytes for the arena, return value is error (83 if allocation failed)*/
+unsigned lodepng_arena_init(LodePNGArena* arena, size_t capacity);
+/*uses a buffer of the caller, which must stay alive while the arena is used*/
+void lodepng_arena_init_buffer(LodePNGArena* arena, void* buffer, size_t capacity);
+/*frees all allocations in the arena at once, they must not be used anymore*/
+void lodepng_arena_reset(LodePNGArena* arena);
+void lodepng_arena_cleanup(LodePNGArena* arena);
+
 #ifdef LODEPNG_COMPILE_DECODER
 /*Settings for zlib decompression*/
 typedef struct LodePNGDecompressSettings LodePNGDecompressSettings;
@@ -290,6 +340,17 @@ struct LodePNGCompressSettings /*deflate = compress*/
   unsigned minmatch; /*mininum lz77 length. 3 is normally best, 6 can be better for some PNGs. Default: 0*/
   unsigned nicematch; /*stop searching if >= this length found. Set to 258 for best compression. Default: 128*/
   unsigned lazymatching; /*use lazy matching: better compression but a bit slower. Default: true*/
+  /*max amount of earlier positions tried per position, 0 for all in the window if windowsize
+  is 8192 or more, windowsize / 8 otherwise. Default: 0*/
+  unsigned maxchainlength;
+  /*find matches with a hash of 4 bytes instead of 3: faster, but it only finds matches of 4 or
+  more and gives different output, so it is only used with minmatch >= 4. Set by
+  lodepng_compress_settings_level. Default: 0*/
+  unsigned hash4;
+
+  /*compress parts of the input at the same time on this many threads, when the built in zlib
+  encoder is used with btype 2. Needs LODEPNG_COMPILE_THREADS. 0 or 1: no threads. Default: 0*/
+  unsigned numthreads;
 
   /*use custom zlib encoder instead of built in one (default: null)*/
   unsigned (*custom_zlib)(unsigned char**, size_t*,
@@ -307,6 +368,13 @@ struct LodePNGCompressSettings /*deflate = compress*/
 
 extern const LodePNGCompressSettings lodepng_default_compress_settings;
 void lodepng_compress_settings_init(LodePNGCompressSettings* settings);
+/*
+Sets the LZ77 settings for a compression level, from 1 (fastest, greedy matching)
+to 9 (smallest, slowest), like zlib's levels. 0 stores the data uncompressed. On PNG
+images even level 1 compresses better than the defaults, which are kept unchanged so
+the same settings keep giving the same output.
+*/
+void lodepng_compress_settings_level(LodePNGCompressSettings* settings, unsigned level);
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 #ifdef LODEPNG_COMPILE_PNG
@@ -524,6 +592,11 @@ typedef struct LodePNGDecoderSettings
 
   unsigned color_convert; /*whether to convert the PNG to the color type you want. Default: yes*/
 
+  /*inflate large non-interlaced images in a second thread, while this one unfilters and
+  converts the rows that are done. Needs LODEPNG_COMPILE_THREADS and a thread-safe
+  lodepng_malloc, ignored otherwise. Default: no*/
+  unsigned pipeline;
+
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned read_text_chunks; /*if false but remember_unknown_chunks is true, they're stored in the unknown chunks*/
   /*store all bytes from unknown chunks in the LodePNGInfo (off by default, useful for a png editor)*/
@@ -630,6 +703,7 @@ typedef struct LodePNGState
   LodePNGColorMode info_raw; /*specifies the format in which you would like to get the raw pixel buffer*/
   LodePNGInfo info_png; /*info of the PNG image obtained after decoding*/
   unsigned error;
+  LodePNGArena* arena; /*scratch memory for lodepng_decode and lodepng_encode, or 0 to use the heap (default)*/
 #ifdef LODEPNG_COMPILE_CPP
   /* For the lodepng::State subclass. */
   virtual ~LodePNGState(){}
@@ -651,6 +725,18 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
                         LodePNGState* state,
                         const unsigned char* in, size_t insize);
 
+/*
+Same as lodepng_decode, but writes the image into the given buffer instead of
+allocating one, for example a mapped pixel unpack buffer. outsize is the size of
+out in bytes; if it's smaller than the decoded image, error 95 is returned. The
+needed size is lodepng_get_raw_size(w, h, &state->info_raw) after lodepng_inspect,
+or with the PNG's own color mode if state->decoder.color_convert is 0.
+Only the inflated scanlines are allocated, as scratch memory during the call.
+*/
+unsigned lodepng_decode_into(unsigned char* out, size_t outsize, unsigned* w, unsigned* h,
+                             LodePNGState* state,
+                             const unsigned char* in, size_t insize);
+
 /*
 Read the PNG header, but not the actual data. This returns only the information
 that is in the header chunk of the PNG, such as width, height and color type. The
@@ -659,6 +745,37 @@ information is placed in the info_png field of the LodePNGState.
 unsigned lodepng_inspect(unsigned* w, unsigned* h,
                          LodePNGState* state,
                          const unsigned char* in, size_t insize);
+
+#ifdef LODEPNG_COMPILE_ZLIB
+/*
+Called by the stream decoder for every row of the image, from top to bottom. row
+has lodepng_get_raw_size(w, 1, &state->info_raw) bytes in the color mode of
+state->info_raw; for bit depths below 8 every row starts at a new byte. The row is
+only valid during the call. Returning nonzero stops decoding with that error.
+*/
+typedef unsigned (*LodePNGRowCallback)(void* user, const unsigned char* row, unsigned y, unsigned w, unsigned h);
+
+/*
+Decoder that takes the PNG in parts, e.g. as it is read from a file or network,
+and gives the image row by row to a callback as soon as they are inflated, so the
+whole image never has to be in memory. It keeps the 32K deflate window, a few rows
+and the not yet decoded part of the input. Interlaced images can only be
+deinterlaced at the end, for those all rows are given once the IEND chunk arrived.
+Uses the settings of the LodePNGState like lodepng_decode, except custom_zlib and
+custom_inflate. The state must stay alive until the decoder is deleted.
+Usage: lodepng_stream_decoder_new, then lodepng_stream_decoder_push for each part of
+the input, then lodepng_stream_decoder_finish to check that the PNG was complete,
+then lodepng_stream_decoder_delete. push and finish return error, which is also
+stored in state->error; after an error, further pushes do nothing.
+lodepng_stream_decoder_new returns 0 if allocation failed.
+*/
+typedef struct LodePNGStreamDecoder LodePNGStreamDecoder;
+
+LodePNGStreamDecoder* lodepng_stream_decoder_new(LodePNGState* state, LodePNGRowCallback callback, void* user);
+void lodepng_stream_decoder_delete(LodePNGStreamDecoder* decoder);
+unsigned lodepng_stream_decoder_push(LodePNGStreamDecoder* decoder, const unsigned char* in, size_t insize);
+unsigned lodepng_stream_decoder_finish(LodePNGStreamDecoder* decoder);
+#endif /*LODEPNG_COMPILE_ZLIB*/
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 
@@ -736,6 +853,12 @@ unsigned lodepng_chunk_create(unsigned char** out, size_t* outlength, unsigned l
 
 /*Calculate CRC32 of buffer*/
 unsigned lodepng_crc32(const unsigned char* buf, size_t len);
+#ifndef LODEPNG_NO_COMPILE_CRC
+/*Self-test of the built in CRC tables: returns 1 if the byte-at-a-time table matches the
+one computed from the polynomial and the 7 slicing-by-8 tables match the ones derived
+from it, 0 if any constant is wrong.*/
+unsigned lodepng_crc32_selftest(void);
+#endif /*LODEPNG_NO_COMPILE_CRC*/
 #endif /*LODEPNG_COMPILE_PNG*/
 
 
@@ -810,6 +933,27 @@ filename: the path to the file to save to
 return value: error code (0 means ok)
 */
 unsigned lodepng_save_file(const unsigned char* buffer, size_t buffersize, const char* filename);
+
+/*The read-only contents of a file, see lodepng_map_file.*/
+typedef struct LodePNGFileMap
+{
+  const unsigned char* data;
+  size_t size;
+  unsigned mapped; /*whether data is mapped, otherwise it's an allocated buffer*/
+} LodePNGFileMap;
+
+/*
+Gives access to the contents of a file without copying it: the file is mapped
+into memory where the platform supports it (see LODEPNG_COMPILE_MMAP), otherwise,
+or if mapping fails (e.g. a pipe), it is read into an allocated buffer. The
+decode-from-file functions use this, so the PNG is read straight from the page
+cache. After success, lodepng_unmap_file must be called when done with the data.
+return value: error code (0 means ok)
+*/
+unsigned lodepng_map_file(LodePNGFileMap* map, const char* filename);
+
+/*Releases the contents given by lodepng_map_file.*/
+void lodepng_unmap_file(LodePNGFileMap* map);
 #endif /*LODEPNG_COMPILE_DISK*/
 
 #ifdef LODEPNG_COMPILE_CPP
@@ -1567,6 +1711,7 @@ state.decoder.zlibsettings.ignore_adler32: ignore ADLER32 checksums
 state.decoder.zlibsettings.custom_...: use custom inflate function
 state.decoder.ignore_crc: ignore CRC checksums
 state.decoder.color_convert: convert internal PNG color to chosen one
+state.decoder.pipeline: inflate large images in a second thread while unfiltering
 state.decoder.read_text_chunks: whether to read in text metadata chunks
 state.decoder.remember_unknown_chunks: whether to read in unknown chunks
 state.info_raw.colortype: desired color type for decoded image
@@ -1582,6 +1727,9 @@ state.encoder.zlibsettings.windowsize: tweak LZ77 windowsize
 state.encoder.zlibsettings.minmatch: tweak min LZ77 length to match
 state.encoder.zlibsettings.nicematch: tweak LZ77 match where to stop searching
 state.encoder.zlibsettings.lazymatching: try one more LZ77 matching
+state.encoder.zlibsettings.maxchainlength: limit the LZ77 matches tried per position
+state.encoder.zlibsettings.hash4: faster 4-byte match hash, with minmatch >= 4
+state.encoder.zlibsettings.numthreads: compress on multiple threads
 state.encoder.zlibsettings.custom_...: use custom deflate function
 state.encoder.auto_convert: choose optimal PNG color type, if 0 uses info_png
 state.encoder.filter_palette_zero: PNG filter strategy for palette
@@ -1,19 +1,46 @@
-// src/main_file.cpp
+﻿// src/main_file.cpp
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <fstream>
 #include <cmath>
-
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "camera.hpp"
+#include "frame_capture.hpp"
 #include "gear.hpp"
 #include "hand.hpp"
+#include "mesh_arena.hpp"
+#include "render_state.hpp"
 #include "shaderprogram.h"
+#include "texture_loader.hpp"
+
+// Nazwy uniformów – constexpr, więc hashe są liczone przy kompilacji
+static constexpr ShaderName UNIFORM_M = "M"_glsl;
 
 // Ścieżki do shaderów:
 static const char* VERTEX_SHADER_PATH = "v_simplest.glsl";
 static const char* FRAGMENT_SHADER_PATH = "f_simplest.glsl";
+static const char* INSTANCED_VERTEX_SHADER_PATH = "v_instanced.glsl";
+static const char* BATCHED_VERTEX_SHADER_PATH = "v_batched.glsl";
+
+// Tekstury dekodowane równolegle przy starcie (tylko z --textures)
+static const std::vector<std::string> TEXTURE_PATHS = {
+    "bricks.png",
+    "bricks2_diffuse.png", "bricks2_height.png", "bricks2_normal.png",
+    "bricks3b_diffuse.png", "bricks3b_height.png", "bricks3b_specular.png",
+    "metal_spec.png", "sky.png", "stone-wall.png", "fur.png", "tiger.png"
+};
 
 // Globalne zmienne aplikacji
 int windowWidth = 800;    // lekko poszerzone
@@ -21,6 +48,9 @@ int windowHeight = 1200;  // nieco niższe
 GLFWwindow* window = nullptr;
 
 ShaderProgram* spLambert = nullptr;
+ShaderProgram* spInstanced = nullptr; // ten sam Lambert, macierz M per instancja
+ShaderProgram* spBatched = nullptr;   // ten sam Lambert, macierz M z bloku Transforms
+Camera* camera = nullptr; // P, V i światło w UBO wspólnym dla shaderów
 
 // Obiekty zegara
 Gear* gearA = nullptr;
@@ -30,8 +60,29 @@ Hand* minuteHand = nullptr;
 Hand* hourHand = nullptr;
 Hand* markerHand = nullptr; // znaczniki godzin
 
-// Lokalizacje uniformów w shaderze
-GLuint locP, locV, locM, locLP;
+// Cała geometria zegara w jednym buforze (--no-batching = rysowanie obiekt po obiekcie)
+bool batching = true;
+MeshArena* meshArena = nullptr;
+// Sloty macierzy poszczególnych obiektów w meshArena
+unsigned slotGearA = 0, slotGearB = 0, slotSecond = 0, slotMinute = 0, slotHour = 0;
+
+// Uchwyty tekstur (ta sama kolejność co TEXTURE_PATHS, 0 = nie wczytano)
+std::vector<GLuint> textures;
+// Materiały zegara nie próbkują jeszcze żadnej tekstury, więc domyślnie ich nie wczytujemy
+bool preloadTextures = false;
+
+// Nagrywanie klatek do PNG (--capture <katalog>), nullptr = wyłączone
+FrameCapture* capture = nullptr;
+
+// Tryb bez okna (--headless N): ukryte okno, scena rysowana do FBO o stałym rozmiarze
+bool headless = false;
+float fixedTimeStep = 0.0f;  // > 0: stały krok animacji zamiast czasu rzeczywistego
+GLuint offscreenFbo = 0;
+GLuint offscreenColor = 0;
+GLuint offscreenDepth = 0;
+
+// Lokalizacja uniformu M w shaderze (reszta jest w bloku Camera)
+GLuint locM;
 
 bool paused = false;
 float elapsedTime = 0.0f;
@@ -62,10 +113,62 @@ void processInput(GLFWwindow* window) {
     }
 }
 
+// ————————————————————————————————————————————————————————————————————————————————
+// Wysłanie zdekodowanego obrazu do OpenGL (tylko z wątku głównego)
+// ————————————————————————————————————————————————————————————————————————————————
+GLuint uploadTexture(const TextureImage& image) {
+    if (image.error) {
+        std::cerr << "[Texture] " << image.path << ": " << lodepng_error_text(image.error) << "\n";
+        return 0;
+    }
+    GLuint tex = 0;
+    glGenTextures(1, &tex);
+    RenderState::activeTexture(GL_TEXTURE0);
+    RenderState::bindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,
+        static_cast<GLsizei>(image.width), static_cast<GLsizei>(image.height), 0,
+        GL_RGBA, GL_UNSIGNED_BYTE, image.pixels.data());
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    RenderState::bindTexture(GL_TEXTURE_2D, 0);
+    return tex;
+}
+
+// ————————————————————————————————————————————————————————————————————————————————
+// Bufor ramki poza ekranem dla trybu bez okna (kolor RGBA8 + głębia)
+// ————————————————————————————————————————————————————————————————————————————————
+bool createOffscreenTarget(int width, int height) {
+    glGenRenderbuffers(1, &offscreenColor);
+    glBindRenderbuffer(GL_RENDERBUFFER, offscreenColor);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &offscreenDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, offscreenDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &offscreenFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, offscreenFbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreenColor);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, offscreenDepth);
+    // FBO zostaje związany do końca – drawScene i FrameCapture używają go zamiast okna
+    glViewport(0, 0, width, height);
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
 // ————————————————————————————————————————————————————————————————————————————————
 // Inicjalizacja OpenGL, tworzenie okna, ładowanie shaderów, obiektów
 // ————————————————————————————————————————————————————————————————————————————————
 void initOpenGLProgram() {
+    // Dekodowanie PNG rusza od razu i nakłada się na tworzenie okna i shaderów
+    std::unique_ptr<TextureLoader> loader;
+    std::vector<std::future<TextureImage>> pending;
+    if (preloadTextures) {
+        loader.reset(new TextureLoader());
+        pending = loader->loadBatch(TEXTURE_PATHS);
+    }
+
     if (!glfwInit()) {
         std::cerr << "Błąd: nie udało się zainicjalizować GLFW\n";
         std::exit(-1);
@@ -73,6 +176,7 @@ void initOpenGLProgram() {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (headless) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
     window = glfwCreateWindow(windowWidth, windowHeight, "Zegar mechaniczny", nullptr, nullptr);
     if (!window) {
@@ -81,7 +185,8 @@ void initOpenGLProgram() {
         std::exit(-1);
     }
     glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    // W trybie bez okna rozmiar jest stały – ukryte okno nie może go zmienić
+    if (!headless) glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
     glewExperimental = GL_TRUE;
     if (glewInit() != GLEW_OK) {
@@ -90,8 +195,19 @@ void initOpenGLProgram() {
         std::exit(-1);
     }
 
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LEQUAL);
+    if (headless) {
+        if (!createOffscreenTarget(windowWidth, windowHeight)) {
+            std::cerr << "Błąd: niekompletny bufor ramki poza ekranem\n";
+            glfwTerminate();
+            std::exit(-1);
+        }
+        const GLubyte* renderer = glGetString(GL_RENDERER);
+        std::cout << "[Headless] " << windowWidth << "x" << windowHeight << ", "
+            << (renderer ? reinterpret_cast<const char*>(renderer) : "?") << "\n";
+    }
+
+    RenderState::setDepthTest(true);
+    RenderState::setDepthFunc(GL_LEQUAL);
     glClearColor(0.8f, 0.8f, 0.8f, 1.0f);
 
     // Ładowanie shaderów
@@ -102,12 +218,24 @@ void initOpenGLProgram() {
     );
     spLambert->use();
 
-    locP = spLambert->u("P");
-    locV = spLambert->u("V");
-    locM = spLambert->u("M");
-    locLP = spLambert->u("lp");
+    locM = spLambert->u(UNIFORM_M);
 
-    glUniform4f(locLP, 1.0f, 1.0f, 1.0f, 1.0f);
+    spInstanced = new ShaderProgram(
+        INSTANCED_VERTEX_SHADER_PATH,
+        nullptr,
+        FRAGMENT_SHADER_PATH
+    );
+
+    spBatched = new ShaderProgram(
+        BATCHED_VERTEX_SHADER_PATH,
+        nullptr,
+        FRAGMENT_SHADER_PATH
+    );
+
+    // Kamera od przodu (na osi Z, z = -5) patrzy na środek, "up" = Y
+    camera = new Camera();
+    camera->lookAt(glm::vec3(0.0f, 0.0f, -5.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    camera->setLightPosition(glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
 
     // Duża zębatka – outerR=1.2, innerR=1.1, 60 zębów
     gearA = new Gear(1.2f, 1.1f, 60, 1.0f);
@@ -119,6 +247,62 @@ void initOpenGLProgram() {
     hourHand = new Hand(0.5f, 0.015f);
     markerHand = new Hand(0.2f, 0.02f);
 
+    // Znaczniki godzin (12 prostokątów) – wewnątrz zębatki, nieruchome, więc
+    // macierze liczymy raz, a rysujemy je jednym wywołaniem instancyjnym
+    std::vector<glm::mat4> markerModels;
+    float markerR = gearA->getInnerRadius() - 0.05f;
+    for (int i = 0; i < 12; ++i) {
+        float angDeg = float(i) * 30.0f; // co 30°
+        glm::mat4 M_mk = glm::rotate(
+            glm::mat4(1.0f),
+            glm::radians(angDeg),
+            glm::vec3(0.0f, 0.0f, 1.0f)
+        );
+        // przesuwamy marker na promień = innerRA - 0.05
+        M_mk = glm::translate(M_mk, glm::vec3(markerR, 0.0f, 0.0f));
+        // obracamy prostokąt o 90° względem promienia
+        M_mk = glm::rotate(
+            M_mk,
+            glm::radians(90.0f),
+            glm::vec3(0.0f, 0.0f, 1.0f)
+        );
+        markerModels.push_back(M_mk);
+    }
+    markerHand->setInstances(markerModels);
+
+    // Ta sama geometria spakowana w jeden VBO/EBO – klatka to wtedy dwa wywołania rysujące
+    if (batching) {
+        meshArena = new MeshArena();
+        slotGearA = meshArena->add(*gearA);
+        slotGearB = meshArena->add(*gearB);
+        slotSecond = meshArena->add(*secondHand);
+        slotMinute = meshArena->add(*minuteHand);
+        slotHour = meshArena->add(*hourHand);
+        unsigned slotMarkers = meshArena->add(*markerHand, static_cast<unsigned>(markerModels.size()));
+        unsigned slots[] = { slotGearA, slotGearB, slotSecond, slotMinute, slotHour, slotMarkers };
+        if (std::find(std::begin(slots), std::end(slots), MeshArena::INVALID_SLOT) != std::end(slots)) {
+            std::cerr << "[Init] Scena nie mieści się w MeshArena, rysowanie obiekt po obiekcie\n";
+            delete meshArena;
+            meshArena = nullptr;
+        } else {
+            for (size_t i = 0; i < markerModels.size(); ++i) {
+                meshArena->setTransform(slotMarkers + static_cast<unsigned>(i), markerModels[i]);
+            }
+            meshArena->build();
+        }
+    }
+
+    // Odbiór tekstur w kolejności zlecenia – wysyłka do GL w wątku głównym
+    if (loader) {
+        double texStart = glfwGetTime();
+        textures.reserve(pending.size());
+        for (std::future<TextureImage>& f : pending) {
+            textures.push_back(uploadTexture(f.get()));
+        }
+        std::cout << "[Init] tekstury: " << textures.size() << " (wątki: " << loader->getThreadCount()
+            << ", oczekiwanie " << (glfwGetTime() - texStart) * 1000.0 << " ms)\n";
+    }
+
     prevTime = static_cast<float>(glfwGetTime());
     std::cout << "[Init] GearA=" << gearA << " GearB=" << gearB
         << " 2nd=" << secondHand << " min=" << minuteHand
@@ -129,13 +313,32 @@ void initOpenGLProgram() {
 // Sprzątanie zasobów
 // ————————————————————————————————————————————————————————————————————————————————
 void cleanup() {
+    if (capture) {
+        capture->finish(); // ostatnia klatka siedzi jeszcze w PBO
+        delete capture;
+        capture = nullptr;
+    }
+    for (GLuint tex : textures) {
+        if (tex) RenderState::deleteTexture(tex);
+    }
+    textures.clear();
+    if (offscreenFbo) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &offscreenFbo);
+        glDeleteRenderbuffers(1, &offscreenColor);
+        glDeleteRenderbuffers(1, &offscreenDepth);
+    }
     delete gearA;
     delete gearB;
     delete secondHand;
     delete minuteHand;
     delete hourHand;
     delete markerHand;
+    delete meshArena;
     delete spLambert;
+    delete spInstanced;
+    delete spBatched;
+    delete camera;
     glfwTerminate();
 }
 
@@ -145,25 +348,13 @@ void cleanup() {
 void drawScene() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    spLambert->use();
-
-    // Projekcja i widok – kamera od przodu (eye z przodu osi, patrzy w dół Z)
-    glm::mat4 Pm = glm::perspective(
-        glm::radians(45.0f),
-        (float)windowWidth / (float)windowHeight,
-        0.1f, 100.0f
-    );
-    glm::mat4 Vm = glm::lookAt(
-        glm::vec3(0.0f, 0.0f, -5.0f),   // kamera na osi Z (z = -5)
-        glm::vec3(0.0f, 0.0f, 0.0f),     // patrzy na środek
-        glm::vec3(0.0f, 1.0f, 0.0f)      // "up" = Y
-    );
-    glUniformMatrix4fv(locP, 1, GL_FALSE, &Pm[0][0]);
-    glUniformMatrix4fv(locV, 1, GL_FALSE, &Vm[0][0]);
+    // Projekcja zależy tylko od proporcji okna – UBO idzie do GPU tylko po jej zmianie
+    camera->setPerspective(45.0f, (float)windowWidth / (float)windowHeight, 0.1f, 100.0f);
+    camera->update();
 
     // Obsługa pauzy i elapsedTime
     float currentTime = static_cast<float>(glfwGetTime());
-    float dt = currentTime - prevTime;
+    float dt = fixedTimeStep > 0.0f ? fixedTimeStep : currentTime - prevTime;
     prevTime = currentTime;
     if (!paused) {
         elapsedTime += dt;
@@ -177,8 +368,6 @@ void drawScene() {
         glm::radians(angleA_deg),
         glm::vec3(0.0f, 0.0f, 1.0f)
     );
-    glUniformMatrix4fv(locM, 1, GL_FALSE, &M_A[0][0]);
-    gearA->draw();
 
     // 2) Mała zębatka – synchronizacja i pozycja pod kątem 225°
     float rpmB = -gearA->getRPM() * (float)gearA->getTeethCount() / (float)gearB->getTeethCount();
@@ -195,8 +384,6 @@ void drawScene() {
         glm::radians(angleB_deg),
         glm::vec3(0.0f, 0.0f, 1.0f)
     );
-    glUniformMatrix4fv(locM, 1, GL_FALSE, &M_B[0][0]);
-    gearB->draw();
 
     // 3) Sekundnik: 6°/s (bez +90°, aby wskazywał na 12 przy t=0)
     float angleSec = fmod(t * 6.0f, 360.0f);
@@ -205,8 +392,6 @@ void drawScene() {
         glm::radians(angleSec),
         glm::vec3(0.0f, 0.0f, 1.0f)
     );
-    glUniformMatrix4fv(locM, 1, GL_FALSE, &M_sec[0][0]);
-    secondHand->draw();
 
     // 4) Minutnik: 0.1°/s, bez +90°
     float angleMin = fmod(t * 0.1f, 360.0f);
@@ -215,8 +400,6 @@ void drawScene() {
         glm::radians(angleMin),
         glm::vec3(0.0f, 0.0f, 1.0f)
     );
-    glUniformMatrix4fv(locM, 1, GL_FALSE, &M_min[0][0]);
-    minuteHand->draw();
 
     // 5) Godzinnik: 0.0083333°/s, bez +90°
     float angleHour = fmod(t * 0.0083333f, 360.0f);
@@ -225,43 +408,153 @@ void drawScene() {
         glm::radians(angleHour),
         glm::vec3(0.0f, 0.0f, 1.0f)
     );
+
+    if (meshArena) {
+        // Cała scena z jednego VAO: macierze do UBO, potem wywołania z MeshArena::draw
+        meshArena->setTransform(slotGearA, M_A);
+        meshArena->setTransform(slotGearB, M_B);
+        meshArena->setTransform(slotSecond, M_sec);
+        meshArena->setTransform(slotMinute, M_min);
+        meshArena->setTransform(slotHour, M_hour);
+        spBatched->use();
+        meshArena->draw();
+        return;
+    }
+
+    spLambert->use();
+    glUniformMatrix4fv(locM, 1, GL_FALSE, &M_A[0][0]);
+    gearA->draw();
+    glUniformMatrix4fv(locM, 1, GL_FALSE, &M_B[0][0]);
+    gearB->draw();
+    glUniformMatrix4fv(locM, 1, GL_FALSE, &M_sec[0][0]);
+    secondHand->draw();
+    glUniformMatrix4fv(locM, 1, GL_FALSE, &M_min[0][0]);
+    minuteHand->draw();
     glUniformMatrix4fv(locM, 1, GL_FALSE, &M_hour[0][0]);
     hourHand->draw();
 
-    // 6) Znaczniki godzin (12 prostokątów) – wewnątrz zębatki
-    float innerRA = gearA->getInnerRadius();
-    for (int i = 0; i < 12; ++i) {
-        float angDeg = float(i) * 30.0f; // co 30°
-        glm::mat4 M_mk = glm::rotate(
-            glm::mat4(1.0f),
-            glm::radians(angDeg),
-            glm::vec3(0.0f, 0.0f, 1.0f)
-        );
-        // przesuwamy marker na promień = innerRA - 0.05
-        float r = innerRA - 0.05f;
-        M_mk = glm::translate(M_mk, glm::vec3(r, 0.0f, 0.0f));
-        // obracamy prostokąt o 90° względem promienia
-        M_mk = glm::rotate(
-            M_mk,
-            glm::radians(90.0f),
-            glm::vec3(0.0f, 0.0f, 1.0f)
-        );
-        glUniformMatrix4fv(locM, 1, GL_FALSE, &M_mk[0][0]);
-        markerHand->draw();
+    // 6) Znaczniki godzin – jedno wywołanie dla wszystkich (macierze z initOpenGLProgram)
+    spInstanced->use();
+    markerHand->drawInstanced();
+}
+
+// ————————————————————————————————————————————————————————————————————————————————
+// Tryb bez okna: frameCount klatek jak najszybciej, potem statystyki czasów klatek
+// ————————————————————————————————————————————————————————————————————————————————
+void runHeadless(unsigned frameCount, const char* statsPath) {
+    std::vector<double> frameTimes;
+    frameTimes.reserve(frameCount);
+    double runStart = glfwGetTime();
+    RenderState::resetCounters(); // bez zmian stanu z inicjalizacji
+
+    for (unsigned i = 0; i < frameCount; ++i) {
+        double start = glfwGetTime();
+        drawScene();
+        if (capture) capture->captureFrame(windowWidth, windowHeight);
+        glFinish(); // bez tego mierzylibyśmy tylko zlecanie poleceń, nie ich wykonanie
+        frameTimes.push_back((glfwGetTime() - start) * 1000.0);
+    }
+    double total = glfwGetTime() - runStart;
+    if (frameTimes.empty()) return;
+
+    const RenderState::Counters& gl = RenderState::counters();
+    double perFrame = 1.0 / frameTimes.size();
+    std::cout << "[RenderState] na klatkę: " << gl.issued * perFrame << " zmian stanu GL (zgłoszono "
+        << gl.requested * perFrame << "), " << gl.draws * perFrame << " wywołań rysujących\n";
+
+    std::vector<double> sorted = frameTimes;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](double p) {
+        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+    };
+    double mean = 0.0;
+    for (double ms : frameTimes) mean += ms;
+    mean /= frameTimes.size();
+
+    std::cout << "[Headless] klatki: " << frameTimes.size() << " w " << total << " s ("
+        << frameTimes.size() / total << " FPS)\n"
+        << "[Headless] czas klatki [ms]: min " << sorted.front() << ", śr. " << mean
+        << ", mediana " << percentile(0.5) << ", p95 " << percentile(0.95)
+        << ", p99 " << percentile(0.99) << ", maks " << sorted.back() << "\n";
+
+    if (statsPath) {
+        std::ofstream stats(statsPath);
+        if (!stats) {
+            std::cerr << "[Headless] Nie można zapisać " << statsPath << "\n";
+            return;
+        }
+        stats << "klatka,czas_ms\n";
+        for (size_t i = 0; i < frameTimes.size(); ++i) stats << i << "," << frameTimes[i] << "\n";
     }
 }
 
 // ————————————————————————————————————————————————————————————————————————————————
 // Główna pętla programu
 // ————————————————————————————————————————————————————————————————————————————————
-int main() {
+int main(int argc, char** argv) {
+    // --capture <katalog> nagrywa każdą klatkę; --capture-block czeka na koder zamiast gubić klatki
+    // --headless N [--size SZERxWYS] [--stats plik.csv] rysuje N klatek bez okna
+    // --textures wczytuje tekstury z TEXTURE_PATHS (na razie nieużywane przez shadery)
+    // --no-batching rysuje każdy obiekt osobno (do porównań z MeshArena)
+    // --no-state-cache wysyła każdą zmianę stanu do GL (do porównań z RenderState)
+    const char* captureDir = nullptr;
+    const char* statsPath = nullptr;
+    unsigned headlessFrames = 0;
+    FrameCapture::Policy capturePolicy = FrameCapture::Policy::Drop;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            captureDir = argv[++i];
+        } else if (std::strcmp(argv[i], "--capture-block") == 0) {
+            capturePolicy = FrameCapture::Policy::Block;
+        } else if (std::strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+            headless = true;
+            headlessFrames = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            int w = 0, h = 0;
+            if (std::sscanf(argv[++i], "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+                windowWidth = w;
+                windowHeight = h;
+            } else {
+                std::cerr << "Zły rozmiar: " << argv[i] << " (oczekiwano np. 1920x1080)\n";
+            }
+        } else if (std::strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            statsPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--textures") == 0) {
+            preloadTextures = true;
+        } else if (std::strcmp(argv[i], "--no-batching") == 0) {
+            batching = false;
+        } else if (std::strcmp(argv[i], "--no-state-cache") == 0) {
+            RenderState::setFiltering(false);
+        } else {
+            std::cerr << "Nieznany argument: " << argv[i] << "\n";
+        }
+    }
+
+    // Bez okna animacja idzie stałym krokiem 60 Hz, więc klatki są powtarzalne
+    if (headless) fixedTimeStep = 1.0f / 60.0f;
+
     initOpenGLProgram();
+    if (captureDir) {
+        capture = new FrameCapture(captureDir, 0, 8, capturePolicy);
+    }
 
     glfwSetTime(0.0);
 
+    if (headless) {
+        runHeadless(headlessFrames, statsPath);
+        cleanup();
+        return 0;
+    }
+
     while (!glfwWindowShouldClose(window)) {
         processInput(window);
         drawScene();
+        if (capture) {
+            // Bufor ramki może mieć inny rozmiar niż okno (HiDPI)
+            int fbWidth = 0, fbHeight = 0;
+            glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+            capture->captureFrame(fbWidth, fbHeight);
+        }
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
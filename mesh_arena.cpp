@@ -0,0 +1,127 @@
+﻿// src/mesh_arena.cpp
+#include "mesh_arena.hpp"
+#include "shaderprogram.h"
+#include "render_state.hpp"
+#include <cstddef>
+#include <iostream>
+
+MeshArena::MeshArena()
+    : vao(0), vbo(0), ebo(0), transformUbo(0)
+{
+}
+
+MeshArena::~MeshArena()
+{
+    if (transformUbo) RenderState::deleteBuffer(transformUbo);
+    if (ebo) RenderState::deleteBuffer(ebo);
+    if (vbo) RenderState::deleteBuffer(vbo);
+    if (vao) RenderState::deleteVertexArray(vao);
+}
+
+unsigned MeshArena::addMesh(const std::vector<glm::vec4>& vertices, const std::vector<glm::vec4>& normals,
+    const std::vector<glm::vec4>& colors, const std::vector<GLuint>& indices, unsigned instances)
+{
+    unsigned slot = static_cast<unsigned>(transforms.size());
+    if (instances == 0 || slot + instances > MAX_TRANSFORMS) {
+        std::cerr << "[MeshArena] Brak slotów na " << instances << " instancji (maks. " << MAX_TRANSFORMS << ")\n";
+        return INVALID_SLOT;
+    }
+
+    MeshRecord record;
+    record.indexCount = static_cast<GLsizei>(indices.size());
+    record.firstIndex = indexData.size();
+    record.baseVertex = static_cast<GLint>(vertexData.size());
+    record.instances = instances;
+    meshes.push_back(record);
+
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        Vertex v;
+        v.position = vertices[i];
+        v.normal = normals[i];
+        v.color = colors[i];
+        v.slot = slot;
+        vertexData.push_back(v);
+    }
+    // Indeksy zostają względem własnej siatki – przesunięcie daje baseVertex
+    indexData.insert(indexData.end(), indices.begin(), indices.end());
+
+    transforms.resize(slot + instances, glm::mat4(1.0f));
+    return slot;
+}
+
+void MeshArena::build()
+{
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
+
+    RenderState::bindVertexArray(vao);
+
+    RenderState::bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER,
+        vertexData.size() * sizeof(Vertex),
+        vertexData.data(),
+        GL_STATIC_DRAW);
+
+    // Atrybuty jak w v_simplest.glsl, plus slot macierzy (location=3, liczba całkowita)
+    GLsizei stride = sizeof(Vertex);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, position));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, normal));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, color));
+    glEnableVertexAttribArray(1);
+    glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, stride, (void*)offsetof(Vertex, slot));
+    glEnableVertexAttribArray(3);
+
+    RenderState::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+        indexData.size() * sizeof(GLuint),
+        indexData.data(),
+        GL_STATIC_DRAW);
+
+    RenderState::bindVertexArray(0);
+    RenderState::bindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Bufor macierzy ma zawsze pełny rozmiar bloku z shadera
+    glGenBuffers(1, &transformUbo);
+    RenderState::bindBuffer(GL_UNIFORM_BUFFER, transformUbo);
+    glBufferData(GL_UNIFORM_BUFFER, MAX_TRANSFORMS * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+    RenderState::bindBuffer(GL_UNIFORM_BUFFER, 0);
+    RenderState::bindBufferBase(GL_UNIFORM_BUFFER, ShaderProgram::TRANSFORMS_BINDING, transformUbo);
+
+    for (const MeshRecord& mesh : meshes) {
+        if (mesh.instances != 1) continue;
+        multiCounts.push_back(mesh.indexCount);
+        multiOffsets.push_back((void*)(mesh.firstIndex * sizeof(GLuint)));
+        multiBaseVertices.push_back(mesh.baseVertex);
+    }
+
+    std::cout << "[MeshArena] siatki=" << meshes.size() << " wierzchołki=" << vertexData.size()
+        << " indeksy=" << indexData.size() << " sloty=" << transforms.size() << "\n";
+
+    // Dane są już w GPU
+    vertexData = std::vector<Vertex>();
+    indexData = std::vector<GLuint>();
+}
+
+void MeshArena::draw()
+{
+    RenderState::bindBuffer(GL_UNIFORM_BUFFER, transformUbo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, transforms.size() * sizeof(glm::mat4), transforms.data());
+
+    RenderState::bindVertexArray(vao);
+    if (!multiCounts.empty()) {
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, multiCounts.data(), GL_UNSIGNED_INT,
+            multiOffsets.data(), static_cast<GLsizei>(multiCounts.size()),
+            multiBaseVertices.data());
+        RenderState::countDraw();
+    }
+    for (const MeshRecord& mesh : meshes) {
+        if (mesh.instances == 1) continue;
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT,
+            (const void*)(mesh.firstIndex * sizeof(GLuint)), static_cast<GLsizei>(mesh.instances),
+            mesh.baseVertex);
+        RenderState::countDraw();
+    }
+}
@@ -0,0 +1,86 @@
+﻿// include/mesh_arena.hpp
+#ifndef MESH_ARENA_HPP
+#define MESH_ARENA_HPP
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <GL/glew.h>
+
+/**
+ * Cała statyczna geometria sceny w jednym VBO/EBO/VAO.
+ *
+ * Każda siatka dostaje przy dodaniu numer slotu (lub kolejne sloty, gdy ma
+ * kilka instancji), zapisany w jej wierzchołkach. Macierze modelu wszystkich
+ * slotów trafiają raz na klatkę do bloku uniformów "Transforms", a shader
+ * v_batched.glsl wybiera macierz po slocie wierzchołka (+ gl_InstanceID).
+ * Dzięki temu klatka to jedno glMultiDrawElementsBaseVertex dla siatek
+ * pojedynczych i po jednym wywołaniu instancyjnym na siatkę powtarzaną.
+ */
+class MeshArena {
+public:
+    /// Rozmiar tablicy models w bloku Transforms (v_batched.glsl).
+    static const unsigned MAX_TRANSFORMS = 64;
+    /// Zwracane przez addMesh, gdy zabrakło slotów (siatka nie została dodana).
+    static const unsigned INVALID_SLOT = ~0u;
+
+    MeshArena();
+    ~MeshArena();
+
+    MeshArena(const MeshArena&) = delete;
+    MeshArena& operator=(const MeshArena&) = delete;
+
+    /**
+     * Dodaje siatkę (przed build()). Zwraca pierwszy z `instances` kolejnych
+     * slotów – instancja i używa macierzy ze slotu zwrócony + i – albo
+     * INVALID_SLOT, gdy slotów zabrakło.
+     */
+    unsigned addMesh(const std::vector<glm::vec4>& vertices, const std::vector<glm::vec4>& normals,
+        const std::vector<glm::vec4>& colors, const std::vector<GLuint>& indices, unsigned instances = 1);
+
+    /// To samo dla obiektu z getterami geometrii (Gear, Hand).
+    template <class Mesh>
+    unsigned add(const Mesh& mesh, unsigned instances = 1) {
+        return addMesh(mesh.getVertices(), mesh.getNormals(), mesh.getColors(), mesh.getIndices(), instances);
+    }
+
+    /// Wysyła zebraną geometrię do GPU; potem można już tylko rysować.
+    void build();
+
+    /// Macierz modelu slotu – obowiązuje od następnego draw().
+    void setTransform(unsigned slot, const glm::mat4& model) { transforms[slot] = model; }
+
+    /// Rysuje wszystkie siatki (program z v_batched.glsl musi być aktywny).
+    void draw();
+
+private:
+    struct Vertex {
+        glm::vec4 position;
+        glm::vec4 normal;
+        glm::vec4 color;
+        GLuint slot;
+    };
+
+    struct MeshRecord {
+        GLsizei indexCount;
+        size_t firstIndex;
+        GLint baseVertex;
+        unsigned instances;
+    };
+
+    std::vector<Vertex> vertexData;  // zwalniane po build()
+    std::vector<GLuint> indexData;
+    std::vector<MeshRecord> meshes;
+    std::vector<glm::mat4> transforms;
+
+    // Argumenty glMultiDrawElementsBaseVertex dla siatek bez instancji
+    std::vector<GLsizei> multiCounts;
+    std::vector<void*> multiOffsets;
+    std::vector<GLint> multiBaseVertices;
+
+    GLuint vao;
+    GLuint vbo;
+    GLuint ebo;
+    GLuint transformUbo;
+};
+
+#endif // MESH_ARENA_HPP
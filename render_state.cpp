@@ -0,0 +1,179 @@
+﻿// src/render_state.cpp
+#include "render_state.hpp"
+
+namespace {
+
+    const GLuint UNKNOWN = ~0u;         // wartość, której GL nigdy nie ma
+    const unsigned MAX_TEXTURE_UNITS = 32;
+
+    // Śledzone cele glBindBuffer (GL_ELEMENT_ARRAY_BUFFER jest stanem VAO)
+    const GLenum BUFFER_TARGETS[] = {
+        GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_PIXEL_PACK_BUFFER, GL_PIXEL_UNPACK_BUFFER
+    };
+    const unsigned BUFFER_TARGET_COUNT = sizeof(BUFFER_TARGETS) / sizeof(BUFFER_TARGETS[0]);
+
+    struct State {
+        GLuint program = UNKNOWN;
+        GLuint vao = UNKNOWN;
+        GLuint buffers[BUFFER_TARGET_COUNT];
+        GLuint activeUnit = UNKNOWN;
+        GLuint textures2D[MAX_TEXTURE_UNITS];
+        GLuint depthTest = UNKNOWN;
+        GLuint depthFunc = UNKNOWN;
+        GLuint depthMask = UNKNOWN;
+
+        State() { forget(); }
+
+        void forget() {
+            program = vao = activeUnit = UNKNOWN;
+            depthTest = depthFunc = depthMask = UNKNOWN;
+            for (GLuint& b : buffers) b = UNKNOWN;
+            for (GLuint& t : textures2D) t = UNKNOWN;
+        }
+    };
+
+    State state;
+    RenderState::Counters stats;
+    bool filtering = true;
+
+    // Zapamiętuje nową wartość i mówi, czy wywołanie GL jest potrzebne
+    bool change(GLuint& cached, GLuint value) {
+        ++stats.requested;
+        if (filtering && cached == value) return false;
+        cached = value;
+        ++stats.issued;
+        return true;
+    }
+
+    int bufferSlot(GLenum target) {
+        for (unsigned i = 0; i < BUFFER_TARGET_COUNT; ++i) {
+            if (BUFFER_TARGETS[i] == target) return static_cast<int>(i);
+        }
+        return -1;
+    }
+}
+
+namespace RenderState {
+
+    void useProgram(GLuint program)
+    {
+        if (change(state.program, program)) glUseProgram(program);
+    }
+
+    void bindVertexArray(GLuint vao)
+    {
+        if (change(state.vao, vao)) glBindVertexArray(vao);
+    }
+
+    void bindBuffer(GLenum target, GLuint buffer)
+    {
+        int slot = bufferSlot(target);
+        if (slot < 0) {
+            // Nieśledzony cel – zawsze do GL
+            ++stats.requested;
+            ++stats.issued;
+            glBindBuffer(target, buffer);
+            return;
+        }
+        if (change(state.buffers[slot], buffer)) glBindBuffer(target, buffer);
+    }
+
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+    {
+        // Wiązania indeksowanego nie pamiętamy, ale GL ustawia przy nim
+        // także zwykłe glBindBuffer(target, buffer)
+        ++stats.requested;
+        ++stats.issued;
+        glBindBufferBase(target, index, buffer);
+        int slot = bufferSlot(target);
+        if (slot >= 0) state.buffers[slot] = buffer;
+    }
+
+    void activeTexture(GLenum unit)
+    {
+        if (change(state.activeUnit, unit)) glActiveTexture(unit);
+    }
+
+    void bindTexture(GLenum target, GLuint texture)
+    {
+        GLuint unit = state.activeUnit == UNKNOWN ? UNKNOWN : state.activeUnit - GL_TEXTURE0;
+        if (target != GL_TEXTURE_2D || unit >= MAX_TEXTURE_UNITS) {
+            ++stats.requested;
+            ++stats.issued;
+            glBindTexture(target, texture);
+            return;
+        }
+        if (change(state.textures2D[unit], texture)) glBindTexture(target, texture);
+    }
+
+    void setDepthTest(bool enabled)
+    {
+        if (!change(state.depthTest, enabled ? 1u : 0u)) return;
+        if (enabled) glEnable(GL_DEPTH_TEST);
+        else glDisable(GL_DEPTH_TEST);
+    }
+
+    void setDepthFunc(GLenum func)
+    {
+        if (change(state.depthFunc, func)) glDepthFunc(func);
+    }
+
+    void setDepthMask(bool enabled)
+    {
+        if (change(state.depthMask, enabled ? 1u : 0u)) glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+    }
+
+    void deleteProgram(GLuint program)
+    {
+        // Aktywny program GL usuwa dopiero po odpięciu, więc nazwa może wrócić później
+        if (state.program == program) state.program = UNKNOWN;
+        glDeleteProgram(program);
+    }
+
+    void deleteVertexArray(GLuint vao)
+    {
+        if (state.vao == vao) state.vao = 0;
+        glDeleteVertexArrays(1, &vao);
+    }
+
+    void deleteBuffer(GLuint buffer)
+    {
+        for (GLuint& b : state.buffers) {
+            if (b == buffer) b = 0;
+        }
+        glDeleteBuffers(1, &buffer);
+    }
+
+    void deleteTexture(GLuint texture)
+    {
+        for (GLuint& t : state.textures2D) {
+            if (t == texture) t = 0;
+        }
+        glDeleteTextures(1, &texture);
+    }
+
+    void invalidate()
+    {
+        state.forget();
+    }
+
+    void setFiltering(bool enabled)
+    {
+        filtering = enabled;
+    }
+
+    void countDraw()
+    {
+        ++stats.draws;
+    }
+
+    const Counters& counters()
+    {
+        return stats;
+    }
+
+    void resetCounters()
+    {
+        stats = Counters();
+    }
+}
@@ -0,0 +1,53 @@
+﻿// include/render_state.hpp
+#ifndef RENDER_STATE_HPP
+#define RENDER_STATE_HPP
+
+#include <GL/glew.h>
+
+/**
+ * Cienka warstwa nad stanem OpenGL: pamięta aktywny program, VAO, bufory
+ * (poza GL_ELEMENT_ARRAY_BUFFER, który należy do VAO), tekstury 2D na
+ * jednostkach oraz stan głębi i pomija wywołania, które niczego by nie
+ * zmieniły. Działa tylko wtedy, gdy cały kod zmienia ten stan przez nią –
+ * po obcym kodzie GL trzeba wywołać invalidate().
+ * Tylko dla wątku z kontekstem GL.
+ */
+namespace RenderState {
+
+    /// Liczniki wywołań przechodzących przez warstwę (od ostatniego resetCounters).
+    struct Counters {
+        unsigned long requested = 0; // wszystkie prośby o zmianę stanu
+        unsigned long issued = 0;    // te, które faktycznie poszły do GL
+        unsigned long draws = 0;     // wywołania rysujące zgłoszone przez countDraw
+    };
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    void bindBuffer(GLenum target, GLuint buffer);
+    /// glBindBufferBase – zawsze do GL, ale zmienia też zapamiętane ogólne wiązanie celu.
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+    void activeTexture(GLenum unit);
+    void bindTexture(GLenum target, GLuint texture);
+
+    void setDepthTest(bool enabled);
+    void setDepthFunc(GLenum func);
+    void setDepthMask(bool enabled);
+
+    /// Usuwanie obiektów – wiązania do usuniętych nazw przestają być pamiętane.
+    void deleteProgram(GLuint program);
+    void deleteVertexArray(GLuint vao);
+    void deleteBuffer(GLuint buffer);
+    void deleteTexture(GLuint texture);
+
+    /// Zapomina cały stan – następne wywołania pójdą do GL bez względu na wartość.
+    void invalidate();
+
+    /// false = każde wywołanie idzie do GL (do porównań); liczniki działają dalej.
+    void setFiltering(bool enabled);
+
+    void countDraw();
+    const Counters& counters();
+    void resetCounters();
+}
+
+#endif // RENDER_STATE_HPP
@@ -2,6 +2,7 @@
 #define _CRT_SECURE_NO_WARNINGS  // aby uniknąć ostrzeżeń przy fopen
 
 #include "shaderprogram.h"
+#include "render_state.hpp"
 #include <vector>
 #include <iostream>
 
@@ -114,6 +115,17 @@ ShaderProgram::ShaderProgram(const char* vertexShaderFile, const char* geometryS
     }
     else {
         std::cout << "[ShaderProgram] Shader program created: " << shaderProgram << "\n";
+        introspect();
+
+        // Blok kamery (jeśli shader go używa) czyta ze wspólnego punktu wiązania
+        GLuint cameraBlock = glGetUniformBlockIndex(shaderProgram, "Camera");
+        if (cameraBlock != GL_INVALID_INDEX) {
+            glUniformBlockBinding(shaderProgram, cameraBlock, CAMERA_BINDING);
+        }
+        GLuint transformsBlock = glGetUniformBlockIndex(shaderProgram, "Transforms");
+        if (transformsBlock != GL_INVALID_INDEX) {
+            glUniformBlockBinding(shaderProgram, transformsBlock, TRANSFORMS_BINDING);
+        }
     }
 }
 
@@ -121,17 +133,92 @@ ShaderProgram::~ShaderProgram() {
     if (vertexShader) { glDetachShader(shaderProgram, vertexShader);   glDeleteShader(vertexShader); }
     if (geometryShader) { glDetachShader(shaderProgram, geometryShader); glDeleteShader(geometryShader); }
     if (fragmentShader) { glDetachShader(shaderProgram, fragmentShader); glDeleteShader(fragmentShader); }
-    if (shaderProgram)  glDeleteProgram(shaderProgram);
+    if (shaderProgram)  RenderState::deleteProgram(shaderProgram);
 }
 
 void ShaderProgram::use() {
-    glUseProgram(shaderProgram);
+    RenderState::useProgram(shaderProgram);
 }
 
 GLuint ShaderProgram::u(const char* variableName) {
-    return glGetUniformLocation(shaderProgram, variableName);
+    return lookup(uniforms, shaderNameHash(variableName), variableName, false);
 }
 
 GLuint ShaderProgram::a(const char* variableName) {
-    return glGetAttribLocation(shaderProgram, variableName);
+    return lookup(attributes, shaderNameHash(variableName), variableName, true);
+}
+
+GLuint ShaderProgram::u(ShaderName variableName) {
+    return lookup(uniforms, variableName.hash, variableName.text, false);
+}
+
+GLuint ShaderProgram::a(ShaderName variableName) {
+    return lookup(attributes, variableName.hash, variableName.text, true);
+}
+
+// Tablica "tab[0]" jest dostępna także jako "tab" (tak jak w glGetUniformLocation)
+static void addVariable(std::unordered_map<std::uint32_t, std::string>& names, const std::string& name) {
+    names.emplace(shaderNameHash(name.c_str()), name);
+    if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+        std::string base = name.substr(0, name.size() - 3);
+        names.emplace(shaderNameHash(base.c_str()), base);
+    }
+}
+
+void ShaderProgram::introspect() {
+    std::unordered_map<std::uint32_t, std::string> names;
+    GLint count = 0;
+    GLint maxLength = 0;
+
+    glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::vector<char> buffer(maxLength > 0 ? maxLength : 1);
+    for (GLint i = 0; i < count; ++i) {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(shaderProgram, static_cast<GLuint>(i), static_cast<GLsizei>(buffer.size()),
+            &length, &size, &type, buffer.data());
+        addVariable(names, std::string(buffer.data(), length));
+    }
+    for (const auto& entry : names) {
+        GLint location = glGetUniformLocation(shaderProgram, entry.second.c_str());
+        if (location < 0) continue; // składowe bloków uniformów nie mają lokalizacji
+        uniforms.emplace(entry.first, Variable{ entry.second, location });
+    }
+
+    names.clear();
+    glGetProgramiv(shaderProgram, GL_ACTIVE_ATTRIBUTES, &count);
+    glGetProgramiv(shaderProgram, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+    buffer.assign(maxLength > 0 ? maxLength : 1, '\0');
+    for (GLint i = 0; i < count; ++i) {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveAttrib(shaderProgram, static_cast<GLuint>(i), static_cast<GLsizei>(buffer.size()),
+            &length, &size, &type, buffer.data());
+        addVariable(names, std::string(buffer.data(), length));
+    }
+    for (const auto& entry : names) {
+        GLint location = glGetAttribLocation(shaderProgram, entry.second.c_str());
+        if (location < 0) continue; // zmienne wbudowane (gl_VertexID itp.)
+        attributes.emplace(entry.first, Variable{ entry.second, location });
+    }
+
+    std::cout << "[ShaderProgram] uniformy: " << uniforms.size()
+        << ", atrybuty: " << attributes.size() << "\n";
+}
+
+GLint ShaderProgram::lookup(VariableTable& table, std::uint32_t hash, const char* name, bool attribute) {
+    auto it = table.find(hash);
+    if (it != table.end() && it->second.name == name) return it->second.location;
+
+    // Zmienna nieaktywna, element tablicy ("models[3]") albo kolizja hasha – pyta sterownik
+    GLint location = attribute
+        ? glGetAttribLocation(shaderProgram, name)
+        : glGetUniformLocation(shaderProgram, name);
+    if (it == table.end()) {
+        table.emplace(hash, Variable{ name, location }); // następnym razem już z tablicy
+    }
+    return location;
 }
@@ -3,22 +3,64 @@
 #define SHADERPROGRAM_H
 
 #include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+/// FNV-1a nazwy zmiennej shadera (constexpr – zob. ShaderName).
+constexpr std::uint32_t shaderNameHash(const char* name, std::uint32_t hash = 2166136261u) {
+    return *name ? shaderNameHash(name + 1, (hash ^ static_cast<unsigned char>(*name)) * 16777619u) : hash;
+}
+
+/// Nazwa zmiennej shadera razem z gotowym hashem (tworzona literałem "M"_glsl).
+/// Hash jest na pewno liczony przy kompilacji tylko w stałej constexpr:
+/// constexpr ShaderName NAME_M = "M"_glsl; – w zwykłym wyrażeniu może to zrobić
+/// dopiero w czasie działania (np. MSVC w Debug).
+struct ShaderName {
+    const char* text;
+    std::uint32_t hash;
+};
+
+constexpr ShaderName operator""_glsl(const char* text, std::size_t) {
+    return ShaderName{ text, shaderNameHash(text) };
+}
 
 class ShaderProgram {
 private:
+    struct Variable {
+        std::string name;
+        GLint location;
+    };
+    // Klucz to shaderNameHash(name); nazwa w Variable rozstrzyga kolizje
+    typedef std::unordered_map<std::uint32_t, Variable> VariableTable;
+
     GLuint shaderProgram;
     GLuint vertexShader;
     GLuint geometryShader;
     GLuint fragmentShader;
+    VariableTable uniforms;
+    VariableTable attributes;
     char* readFile(const char* fileName);
     GLuint loadShader(GLenum shaderType, const char* fileName);
+    void introspect();
+    GLint lookup(VariableTable& table, std::uint32_t hash, const char* name, bool attribute);
 
 public:
+    /// Punkt wiązania bloku uniformów "Camera" (zob. Camera) – ten sam w każdym programie
+    static const GLuint CAMERA_BINDING = 0;
+    /// Punkt wiązania bloku "Transforms" z macierzami modeli (zob. MeshArena)
+    static const GLuint TRANSFORMS_BINDING = 1;
+
     ShaderProgram(const char* vertexShaderFile, const char* geometryShaderFile, const char* fragmentShaderFile);
     ~ShaderProgram();
     void use();
+    /// Lokalizacje z tablicy zbudowanej po linkowaniu – bez zapytań do sterownika.
     GLuint u(const char* variableName);
     GLuint a(const char* variableName);
+    /// Jak wyżej, ale z gotowym hashem nazwy (stała constexpr ShaderName, zob. wyżej).
+    GLuint u(ShaderName variableName);
+    GLuint a(ShaderName variableName);
 };
 
 #endif // SHADERPROGRAM_H
@@ -0,0 +1,141 @@
+﻿// src/texture_loader.cpp
+#include "texture_loader.hpp"
+#include <iostream>
+#include <memory>
+
+// Pamięć robocza jednego wątku – wystarcza na scanlines tekstury 2048x2048 RGBA,
+// większe obrazy po prostu sięgają dalej do sterty.
+static const size_t WORKER_ARENA_SIZE = 20u * 1024u * 1024u;
+
+TextureImage decodeTexture(const std::string& path, LodePNGArena* arena, bool pipeline)
+{
+    TextureImage image;
+    image.path = path;
+
+    LodePNGFileMap map;
+    image.error = lodepng_map_file(&map, path.c_str());
+    if (image.error) return image;
+
+    lodepng::State state;
+    state.arena = arena;
+    state.decoder.pipeline = pipeline ? 1 : 0;
+
+    // Najpierw sam nagłówek, żeby zdekodować od razu do docelowego wektora
+    image.error = lodepng_inspect(&image.width, &image.height, &state, map.data, map.size);
+    if (!image.error) {
+        image.pixels.resize(lodepng_get_raw_size(image.width, image.height, &state.info_raw));
+        image.error = lodepng_decode_into(image.pixels.data(), image.pixels.size(),
+            &image.width, &image.height, &state, map.data, map.size);
+    }
+    if (image.error) image.pixels.clear();
+
+    lodepng_unmap_file(&map);
+    if (arena) lodepng_arena_reset(arena);
+    return image;
+}
+
+TextureLoader::TextureLoader(unsigned threadCount)
+    : maxWorkers(threadCount), busy(0), stopping(false)
+{
+    if (maxWorkers == 0) maxWorkers = std::thread::hardware_concurrency();
+    if (maxWorkers == 0) maxWorkers = 2;
+}
+
+TextureLoader::~TextureLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (std::thread& t : workers) t.join();
+}
+
+TextureLoader::Job TextureLoader::makeJob(const std::string& path, std::future<TextureImage>& result)
+{
+    // packaged_task nie jest kopiowalny, a std::function tego wymaga
+    auto task = std::make_shared<std::packaged_task<TextureImage(LodePNGArena*, bool)>>(
+        [path](LodePNGArena* arena, bool pipeline) { return decodeTexture(path, arena, pipeline); });
+    result = task->get_future();
+    return [task](LodePNGArena* arena, bool pipeline) { (*task)(arena, pipeline); };
+}
+
+std::future<TextureImage> TextureLoader::load(const std::string& path)
+{
+    std::future<TextureImage> result;
+    Job job = makeJob(path, result);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+        spawnWorkers();
+    }
+    wakeUp.notify_one();
+    return result;
+}
+
+std::vector<std::future<TextureImage>> TextureLoader::loadBatch(const std::vector<std::string>& paths)
+{
+    std::vector<std::future<TextureImage>> results(paths.size());
+    std::vector<Job> batch;
+    batch.reserve(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+        batch.push_back(makeJob(paths[i], results[i]));
+    }
+    {
+        // Cała partia naraz, żeby pierwszy wątek nie uznał puli za bezczynną
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Job& job : batch) jobs.push_back(std::move(job));
+        spawnWorkers();
+    }
+    wakeUp.notify_all();
+    return results;
+}
+
+void TextureLoader::spawnWorkers()
+{
+    // Wywoływane pod blokadą: tyle wątków, ile plików czeka lub jest w toku (12 tekstur
+    // na 32 rdzeniach to 12 wątków, nie 32)
+    while (workers.size() < maxWorkers && workers.size() < busy + jobs.size()) {
+        workers.emplace_back(&TextureLoader::workerLoop, this);
+    }
+}
+
+void TextureLoader::workerLoop()
+{
+    // Każdy wątek ma własną arenę, więc dekodowania nie walczą o stertę;
+    // rezerwowana przy pierwszym zadaniu
+    LodePNGArena arena;
+    LodePNGArena* arenaPtr = nullptr;
+    bool arenaTried = false;
+
+    for (;;) {
+        Job job;
+        bool pipeline;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeUp.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty()) break; // stopping i nic więcej do zrobienia
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            // Drugi wątek na inflate tylko dla pliku dekodowanego w pojedynkę –
+            // przy pełnej puli rdzenie są już zajęte
+            pipeline = busy == 0 && jobs.empty();
+            ++busy;
+        }
+        if (!arenaTried) {
+            arenaTried = true;
+            if (lodepng_arena_init(&arena, WORKER_ARENA_SIZE)) {
+                std::cerr << "[TextureLoader] Brak pamięci na arenę, dekodowanie ze sterty\n";
+            } else {
+                arenaPtr = &arena;
+            }
+        }
+        job(arenaPtr, pipeline);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --busy;
+        }
+    }
+
+    if (arenaPtr) lodepng_arena_cleanup(&arena);
+}
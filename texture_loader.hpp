@@ -0,0 +1,79 @@
+﻿// include/texture_loader.hpp
+#ifndef TEXTURE_LOADER_HPP
+#define TEXTURE_LOADER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lodepng.h"
+
+/**
+ * Zdekodowany obraz PNG (zawsze RGBA, 8 bitów na kanał).
+ * error != 0 oznacza błąd lodepng – opis daje lodepng_error_text(error).
+ */
+struct TextureImage {
+    std::string path;
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned error = 0;
+    std::vector<unsigned char> pixels;
+};
+
+/**
+ * Wsadowe dekodowanie tekstur PNG na puli wątków roboczych.
+ * Każdy plik jest dekodowany w całości przez jeden wątek, więc czas startu
+ * skaluje się z liczbą rdzeni, a nie z sumarycznym rozmiarem plików.
+ * Wątek główny odbiera wyniki przez std::future i sam wysyła je do OpenGL
+ * (kontekst GL jest przypięty tylko do niego). Wątki (i ich areny) powstają
+ * dopiero przy zleceniach, najwyżej po jednym na niezakończony plik.
+ */
+class TextureLoader {
+public:
+    /**
+     * @param threadCount Największa liczba wątków roboczych (0 = liczba rdzeni)
+     */
+    explicit TextureLoader(unsigned threadCount = 0);
+    ~TextureLoader();
+
+    TextureLoader(const TextureLoader&) = delete;
+    TextureLoader& operator=(const TextureLoader&) = delete;
+
+    /// Zleca dekodowanie jednego pliku; wynik dostępny przez future.
+    std::future<TextureImage> load(const std::string& path);
+
+    /// Zleca dekodowanie wszystkich plików naraz (kolejność wyników = kolejność ścieżek).
+    std::vector<std::future<TextureImage>> loadBatch(const std::vector<std::string>& paths);
+
+    /// Liczba wątków roboczych utworzonych dotąd (tylko z wątku zlecającego).
+    unsigned getThreadCount() const { return static_cast<unsigned>(workers.size()); }
+
+private:
+    // Argumenty: arena wątku roboczego i czy dekodować z potokiem lodepng
+    typedef std::function<void(LodePNGArena*, bool)> Job;
+
+    static Job makeJob(const std::string& path, std::future<TextureImage>& result);
+    void spawnWorkers();
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::deque<Job> jobs;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    unsigned maxWorkers;
+    unsigned busy;  // wątki w trakcie dekodowania
+    bool stopping;
+};
+
+/**
+ * Dekoduje jeden plik PNG w bieżącym wątku (arena może być nullptr).
+ * pipeline = inflate w osobnym wątku – opłaca się tylko, gdy reszta rdzeni jest wolna.
+ */
+TextureImage decodeTexture(const std::string& path, LodePNGArena* arena, bool pipeline = false);
+
+#endif // TEXTURE_LOADER_HPP
@@ -0,0 +1,33 @@
+// pliki zasobow/v_instanced.glsl
+// Wariant v_simplest.glsl do rysowania instancyjnego: macierz modelu
+// przychodzi jako atrybut per instancja zamiast uniformu M.
+#version 330 core
+
+layout(location = 0) in vec4 vertex;     // pozycja wierzchołka (x,y,z,1)
+layout(location = 1) in vec4 color;      // kolor wierzchołka (r,g,b,a)
+layout(location = 2) in vec4 normal;     // normalna wierzchołka (nx,ny,nz,0)
+layout(location = 3) in mat4 instanceM;  // macierz modelu instancji (lokalizacje 3..6)
+
+// Dane kamery wspólne dla wszystkich programów (UBO, zob. camera.hpp)
+layout(std140) uniform Camera {
+    mat4 P;        // macierz projekcji
+    mat4 V;        // macierz widoku
+    mat4 PV;       // P * V, policzone raz na zmianę kamery
+    vec4 lp;       // pozycja źródła światła w przestrzeni świata
+};
+
+out vec4 iC;       // kolor przekazany do fragment shadera
+out vec4 l;        // wektor do światła (w przestrzeni oka)
+out vec4 n;        // normalna (w przestrzeni oka)
+out vec4 v;        // wektor do obserwatora (w przestrzeni oka)
+
+void main(void) {
+    // Wektor do światła: (lp - M*vertex) przekształcone macierzą V
+    l = normalize(V * (lp - instanceM * vertex));
+    // Normalna przekształcona podobnie
+    n = normalize(V * instanceM * normal);
+    // Wektor do obserwatora (kamery w (0,0,0) w przestrzeni oka)
+    v = normalize(vec4(0, 0, 0, 1) - V * instanceM * vertex);
+    iC = color;
+    gl_Position = PV * instanceM * vertex;
+}
@@ -5,10 +5,15 @@ layout(location = 0) in vec4 vertex;   // pozycja wierzchołka (x,y,z,1)
 layout(location = 1) in vec4 color;    // kolor wierzchołka (r,g,b,a)
 layout(location = 2) in vec4 normal;   // normalna wierzchołka (nx,ny,nz,0)
 
-uniform mat4 P;    // macierz projekcji
-uniform mat4 V;    // macierz widoku
+// Dane kamery wspólne dla wszystkich programów (UBO, zob. camera.hpp)
+layout(std140) uniform Camera {
+    mat4 P;        // macierz projekcji
+    mat4 V;        // macierz widoku
+    mat4 PV;       // P * V, policzone raz na zmianę kamery
+    vec4 lp;       // pozycja źródła światła w przestrzeni świata
+};
+
 uniform mat4 M;    // macierz modelu
-uniform vec4 lp;   // pozycja źródła światła w przestrzeni świata
 
 out vec4 iC;       // kolor przekazany do fragment shadera
 out vec4 l;        // wektor do światła (w przestrzeni oka)
@@ -23,5 +28,5 @@ void main(void) {
     // Wektor do obserwatora (kamery w (0,0,0) w przestrzeni oka)
     v = normalize(vec4(0, 0, 0, 1) - V * M * vertex);
     iC = color;
-    gl_Position = P * V * M * vertex;
+    gl_Position = PV * M * vertex;
 }